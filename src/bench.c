@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#ifndef __linux__
+#include <sys/resource.h>
+#endif
+#endif
+
+#include "bench.h"
+#include "vm.h"
+
+//$count is replaced by the workload's size, $row by 200 nulls, the most
+//elements an array literal holds comfortably. string_churn makes strings
+//that were never seen before, the language can't turn numbers into text.
+//Default sizes run for half a second to a second each in an optimized
+//build, long enough that timer and scheduler noise stay small next to them
+typedef struct {
+    const char* name;
+    const char* source;
+    int count;
+    int frames;  //Run draw() for this many frames, 0 for setup() only
+} Workload;
+
+static const Workload workloads[] = {
+    {"high_mortality",
+     "entity Node {}\n"
+     "define setup() {\n"
+     "    for (var i = 0; i < $count; i = i + 1) {\n"
+     "        var temp = Node();\n"
+     "        temp.x = i;\n"
+     "    }\n"
+     "}\n", 20000000, 0},
+
+    {"low_mortality",
+     "entity Node {}\n"
+     "define setup() {\n"
+     "    for (var round = 0; round < $count; round = round + 1) {\n"
+     "        var head = Node();\n"
+     "        var current = head;\n"
+     "        for (var i = 0; i < 250000; i = i + 1) {\n"
+     "            var node = Node();\n"
+     "            node.x = i;\n"
+     "            current.next = node;\n"
+     "            current = node;\n"
+     "        }\n"
+     "    }\n"
+     "}\n", 16, 0},
+
+    {"cycles",
+     "entity Node {}\n"
+     "define setup() {\n"
+     "    var keep = null;\n"
+     "    for (var i = 0; i < $count; i = i + 1) {\n"
+     "        var a = Node();\n"
+     "        var b = Node();\n"
+     "        a.next = b;\n"
+     "        b.prev = a;\n"
+     "        if (i == 1000) keep = a;\n"
+     "    }\n"
+     "}\n", 8000000, 0},
+
+    {"write_barrier",
+     "entity Node {}\n"
+     "define setup() {\n"
+     "    var holder = Node();\n"
+     "    for (var i = 0; i < 10000; i = i + 1) { var temp = Node(); }\n"
+     "    for (var i = 0; i < $count; i = i + 1) {\n"
+     "        holder.x = Node();\n"
+     "    }\n"
+     "}\n", 20000000, 0},
+
+    {"large_arrays",
+     "define setup() {\n"
+     "    var keep = [$row];\n"
+     "    var slot = 0;\n"
+     "    for (var i = 0; i < $count; i = i + 1) {\n"
+     "        var row = [$row];\n"
+     "        row[0] = i;\n"
+     "        keep[slot] = row;\n"
+     "        slot = slot + 1;\n"
+     "        if (slot == 200) slot = 0;\n"
+     "    }\n"
+     "}\n", 300000, 0},
+
+    {"string_churn",
+     "define setup() {\n"
+     "    var x = \"\";\n"
+     "    var y = \"\";\n"
+     "    var z = \"\";\n"
+     "    var xs = 0;\n"
+     "    var ys = 0;\n"
+     "    for (var i = 0; i < $count; i = i + 1) {\n"
+     "        x = x + \"x\";\n"
+     "        xs = xs + 1;\n"
+     "        if (xs == 64) {\n"
+     "            x = \"\";\n"
+     "            xs = 0;\n"
+     "            y = y + \"y\";\n"
+     "            ys = ys + 1;\n"
+     "            if (ys == 64) { y = \"\"; ys = 0; z = z + \"z\"; }\n"
+     "        }\n"
+     "        var s = z + y + x;\n"
+     "    }\n"
+     "}\n", 1000000, 0},
+
+    {"frames",
+     "entity Node {}\n"
+     "define setup() {\n"
+     "    var kept = [$row];\n"
+     "    var slot = 0;\n"
+     "}\n"
+     "define draw() {\n"
+     "    for (var i = 0; i < $count; i = i + 1) {\n"
+     "        var temp = Node();\n"
+     "        temp.x = i;\n"
+     "    }\n"
+     "    kept[slot] = Node();\n"
+     "    slot = slot + 1;\n"
+     "    if (slot == 200) slot = 0;\n"
+     "}\n", 30000, 600},
+};
+
+#define WORKLOAD_COUNT ((int)(sizeof(workloads) / sizeof(workloads[0])))
+#define ROW_LENGTH 200
+
+typedef struct {
+    bool ok;
+    double wall;        //Seconds
+    double wallMin;     //Fastest of the runs
+    double spread;      //How much slower the median was than the fastest
+    size_t pauses;
+    double pauseP50;    //Seconds, over the pauses still in the GC log
+    double pauseP90;
+    double pauseP99;
+    double pauseMax;
+    double totalPause;
+    size_t peakResident;
+    size_t allocations;
+    size_t allocatedBytes;
+    size_t promoted;
+} BenchResult;
+
+static char* expandSource(const char* source, int count) {
+    size_t capacity = strlen(source) + 2 * ROW_LENGTH * sizeof("null, ") + 64;
+    char* expanded = (char*)malloc(capacity);
+    if (expanded == NULL) exit(1);
+
+    char* out = expanded;
+    for (const char* c = source; *c != '\0';) {
+        if (strncmp(c, "$count", 6) == 0) {
+            out += sprintf(out, "%d", count);
+            c += 6;
+        }
+        else if (strncmp(c, "$row", 4) == 0) {
+            for (int i = 0; i < ROW_LENGTH; i++) {
+                out += sprintf(out, i == 0 ? "null" : ", null");
+            }
+            c += 4;
+        }
+        else {
+            *out++ = *c++;
+        }
+    }
+    *out = '\0';
+    return expanded;
+}
+
+//Peak resident set since the last reset. Only Linux can reset it, elsewhere
+//it is the peak of the process the run is in
+static void resetPeakResident() {
+    #ifdef __linux__
+    FILE* file = fopen("/proc/self/clear_refs", "w");
+    if (file == NULL) return;
+    fputs("5", file);
+    fclose(file);
+    #endif
+}
+
+static size_t peakResident() {
+    #ifdef __linux__
+    FILE* file = fopen("/proc/self/status", "r");
+    if (file == NULL) return 0;
+    char line[256];
+    size_t kilobytes = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "VmHWM: %zu kB", &kilobytes) == 1) break;
+    }
+    fclose(file);
+    return kilobytes * 1024;
+    #elif !defined(_WIN32)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    #ifdef __APPLE__
+    return (size_t)usage.ru_maxrss;
+    #else
+    return (size_t)usage.ru_maxrss * 1024;
+    #endif
+    #else
+    return 0;
+    #endif
+}
+
+static int compareDoubles(const void* a, const void* b) {
+    double left = *(const double*)a;
+    double right = *(const double*)b;
+    return (left > right) - (left < right);
+}
+
+//Nearest rank
+static double percentile(double* sorted, size_t count, double fraction) {
+    if (count == 0) return 0;
+    size_t rank = (size_t)(fraction * count + 0.999999);
+    if (rank == 0) rank = 1;
+    return sorted[rank - 1];
+}
+
+static void readPauses(BenchResult* result) {
+    GCLog* log = &vm.gcLog;
+    size_t kept = log->count < GC_LOG_SIZE ? log->count : GC_LOG_SIZE;
+    double* pauses = (double*)malloc(sizeof(double) * (kept + 1));
+    if (pauses == NULL) exit(1);
+    for (size_t i = 0; i < kept; i++) {
+        pauses[i] = log->events[i].end - log->events[i].start;
+    }
+    qsort(pauses, kept, sizeof(double), compareDoubles);
+
+    result->pauses = log->count;
+    result->pauseP50 = percentile(pauses, kept, 0.50);
+    result->pauseP90 = percentile(pauses, kept, 0.90);
+    result->pauseP99 = percentile(pauses, kept, 0.99);
+    result->pauseMax = log->worstPause;
+    result->totalPause = log->totalPause;
+    free(pauses);
+}
+
+//Every run starts from a fresh VM, so nothing a previous workload left in
+//the heap or the pacer carries over
+static BenchResult runWorkload(const Workload* workload, const char* source, int scale) {
+    BenchResult result;
+    memset(&result, 0, sizeof(BenchResult));
+
+    int markThreads = vm.markThreads;
+    freeVM();
+    initVM();
+    vm.markThreads = markThreads;
+    vm.frameLimit = workload->frames * scale;
+    vm.quiet = true;
+
+    resetPeakResident();
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    result.ok = interpret(source) == INTERPRET_OK;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    result.wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    result.peakResident = peakResident();
+    result.allocations = vm.gcLog.allocations;
+    result.allocatedBytes = vm.gcLog.allocatedBytes;
+    result.promoted = vm.gcLog.promoted;
+    readPauses(&result);
+    return result;
+}
+
+//Each run gets a process of its own where there is fork, so the peak
+//resident set is the workload's and not what malloc kept from the last one,
+//and a crash fails the workload instead of the suite
+static BenchResult runIsolated(const Workload* workload, const char* source, int scale) {
+    #ifndef _WIN32
+    int fds[2];
+    fflush(stdout);
+    fflush(stderr);
+    if (pipe(fds) == 0) {
+        pid_t child = fork();
+        if (child == 0) {
+            close(fds[0]);
+            BenchResult result = runWorkload(workload, source, scale);
+            bool sent = write(fds[1], &result, sizeof(BenchResult)) == sizeof(BenchResult);
+            freeVM();
+            fflush(stdout);
+            _exit(sent ? 0 : 1);
+        }
+
+        close(fds[1]);
+        BenchResult result;
+        memset(&result, 0, sizeof(BenchResult));
+        bool received = child > 0 &&
+            read(fds[0], &result, sizeof(BenchResult)) == sizeof(BenchResult);
+        close(fds[0]);
+        if (child > 0) {
+            waitpid(child, NULL, 0);
+            if (!received) result.ok = false;
+            return result;
+        }
+    }
+    #endif
+    return runWorkload(workload, source, scale);
+}
+
+static int compareWall(const void* a, const void* b) {
+    return compareDoubles(&((const BenchResult*)a)->wall, &((const BenchResult*)b)->wall);
+}
+
+//One workload per line, so a baseline can be read back a line at a time
+static void writeResult(FILE* file, const char* name, BenchResult* result, bool last) {
+    fprintf(file, "  {\"name\": \"%s\", \"ok\": %s, \"wallMs\": %.3f, \"wallMinMs\": %.3f, "
+            "\"wallSpread\": %.4f, \"pauses\": %zu, "
+            "\"pauseP50Ms\": %.4f, \"pauseP90Ms\": %.4f, \"pauseP99Ms\": %.4f, "
+            "\"pauseMaxMs\": %.4f, \"totalPauseMs\": %.3f, \"peakRssBytes\": %zu, "
+            "\"allocations\": %zu, \"allocatedBytes\": %zu, \"promotedBytes\": %zu}%s\n",
+            name, result->ok ? "true" : "false", result->wall * 1000, result->wallMin * 1000,
+            result->spread, result->pauses,
+            result->pauseP50 * 1000, result->pauseP90 * 1000, result->pauseP99 * 1000,
+            result->pauseMax * 1000, result->totalPause * 1000, result->peakResident,
+            result->allocations, result->allocatedBytes, result->promoted,
+            last ? "" : ",");
+}
+
+static bool readField(const char* line, const char* field, double* value) {
+    char key[64];
+    snprintf(key, sizeof(key), "\"%s\": ", field);
+    const char* found = strstr(line, key);
+    return found != NULL && sscanf(found + strlen(key), "%lf", value) == 1;
+}
+
+//Finds the workload's line in a file runBenchmarks wrote. Fields an older
+//file doesn't have are left 0 and not compared
+static bool readBaseline(const char* path, const char* name, BenchResult* base) {
+    memset(base, 0, sizeof(BenchResult));
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return false;
+
+    char key[64];
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+    char line[1024];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), file) != NULL) {
+        found = strstr(line, key) != NULL;
+    }
+    fclose(file);
+    if (!found) return false;
+
+    double value;
+    if (readField(line, "wallMinMs", &value)) base->wallMin = value / 1000;
+    if (readField(line, "wallSpread", &value)) base->spread = value;
+    if (readField(line, "pauseP99Ms", &value)) base->pauseP99 = value / 1000;
+    if (readField(line, "peakRssBytes", &value)) base->peakResident = (size_t)value;
+    if (readField(line, "allocatedBytes", &value)) base->allocatedBytes = (size_t)value;
+    return true;
+}
+
+static double change(double now, double before) {
+    return before > 0 ? 100.0 * (now - before) / before : 0;
+}
+
+static bool regressed(double now, double before, double tolerance, double slack) {
+    return before > 0 && now > before * (1 + tolerance) + slack;
+}
+
+static void reportRegression(const char* name, const char* metric, double now,
+                             double before) {
+    printf("bench: %-16s %s %+.1f%% over the baseline\n", name, metric, change(now, before));
+}
+
+//The middle of BENCH_RUNS values, sorts them in place
+static double median(double* values) {
+    qsort(values, BENCH_RUNS, sizeof(double), compareDoubles);
+    return values[BENCH_RUNS / 2];
+}
+
+bool runBenchmarks(const char* outPath, const char* baselinePath, int scale) {
+    FILE* out = fopen(outPath, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Could not write \"%s\".\n", outPath);
+        return false;
+    }
+    if (scale < 1) scale = 1;
+
+    BenchResult results[WORKLOAD_COUNT];
+    for (int i = 0; i < WORKLOAD_COUNT; i++) {
+        //Frame workloads scale the number of frames, not the work in each
+        int count = workloads[i].frames > 0 ? workloads[i].count : workloads[i].count * scale;
+        char* source = expandSource(workloads[i].source, count);
+        BenchResult runs[BENCH_RUNS];
+        for (int run = 0; run < BENCH_RUNS; run++) {
+            runs[run] = runIsolated(&workloads[i], source, scale);
+        }
+        free(source);
+
+        qsort(runs, BENCH_RUNS, sizeof(BenchResult), compareWall);
+        results[i] = runs[BENCH_RUNS / 2];
+        results[i].wallMin = runs[0].wall;
+        results[i].spread = runs[0].wall > 0 ? results[i].wall / runs[0].wall - 1 : 0;
+
+        double pauses[BENCH_RUNS];
+        for (int run = 0; run < BENCH_RUNS; run++) {
+            if (!runs[run].ok) results[i].ok = false;
+            pauses[run] = runs[run].pauseP99;
+            if (runs[run].peakResident < results[i].peakResident) {
+                results[i].peakResident = runs[run].peakResident;
+            }
+        }
+        results[i].pauseP99 = median(pauses);
+    }
+
+    fprintf(out, "{\"scale\": %d, \"runs\": %d, \"workloads\": [\n", scale, BENCH_RUNS);
+    for (int i = 0; i < WORKLOAD_COUNT; i++) {
+        writeResult(out, workloads[i].name, &results[i], i + 1 == WORKLOAD_COUNT);
+    }
+    fprintf(out, "]}\n");
+    fclose(out);
+
+    bool passed = true;
+    printf("bench: %-16s %10s %10s %10s %10s %12s %16s\n",
+            "workload", "wall ms", "min ms", "p99 ms", "max ms", "peak rss", "vs base");
+    for (int i = 0; i < WORKLOAD_COUNT; i++) {
+        BenchResult* result = &results[i];
+        const char* name = workloads[i].name;
+        char versus[32] = "-";
+        BenchResult base = {0};
+        bool compared = baselinePath != NULL && readBaseline(baselinePath, name, &base);
+
+        //The fastest runs are compared, they are the least disturbed by the
+        //rest of the machine, and either side being noisy widens the
+        //tolerance by as much. Mark slices are time budgeted, so a loaded
+        //machine also lets the heap grow and pauses run longer
+        double noise = result->spread > base.spread ? result->spread : base.spread;
+        bool slower = false;
+        if (compared && base.wallMin > 0) {
+            snprintf(versus, sizeof(versus), "%+.1f%%", change(result->wallMin, base.wallMin));
+            slower = regressed(result->wallMin, base.wallMin, BENCH_TOLERANCE + noise, 0);
+        }
+        bool biggerResident = compared &&
+            regressed((double)result->peakResident, (double)base.peakResident,
+                      BENCH_RESIDENT_TOLERANCE + noise, BENCH_MEMORY_SLACK);
+        bool moreAllocated = compared &&
+            regressed((double)result->allocatedBytes, (double)base.allocatedBytes,
+                      BENCH_ALLOCATED_TOLERANCE, BENCH_MEMORY_SLACK);
+        bool longerPauses = compared &&
+            regressed(result->pauseP99, base.pauseP99, BENCH_PAUSE_TOLERANCE + noise,
+                      BENCH_PAUSE_SLACK);
+
+        if (slower) {
+            strcat(versus, " slower");
+        } else if (biggerResident || moreAllocated || longerPauses) {
+            strcat(versus, " worse");
+        }
+        if (!result->ok) strcpy(versus, "failed");
+        if (!result->ok || slower || biggerResident || moreAllocated || longerPauses) {
+            passed = false;
+        }
+
+        printf("bench: %-16s %10.3f %10.3f %10.4f %10.4f %12zu %16s\n", name,
+                result->wall * 1000, result->wallMin * 1000, result->pauseP99 * 1000,
+                result->pauseMax * 1000, result->peakResident, versus);
+        if (biggerResident) {
+            reportRegression(name, "peak rss", (double)result->peakResident,
+                             (double)base.peakResident);
+        }
+        if (moreAllocated) {
+            reportRegression(name, "allocated bytes", (double)result->allocatedBytes,
+                             (double)base.allocatedBytes);
+        }
+        if (longerPauses) reportRegression(name, "p99 pause", result->pauseP99, base.pauseP99);
+    }
+    return passed;
+}
@@ -0,0 +1,41 @@
+#ifndef graphiC_bench_h
+#define graphiC_bench_h
+
+#include "common.h"
+
+//Each workload is run this many times. The run with the median wall time
+//is the one reported, with the median p99 pause and the smallest peak
+//resident set over all runs. The fastest run is held to the baseline
+#ifndef BENCH_RUNS
+#define BENCH_RUNS 5
+#endif
+
+//How much slower than the baseline a workload's fastest run may get before
+//it counts as a regression, on top of how far apart its runs were
+#ifndef BENCH_TOLERANCE
+#define BENCH_TOLERANCE 0.10
+#endif
+
+//How much a workload's peak resident set, allocated bytes and p99 pause may
+//grow over the baseline's. The resident set and pauses follow the pacing,
+//which is timed, so they get more room than the allocations, which don't.
+//Each also gets some slack, small processes and microsecond pauses jitter
+//by more than the tolerance
+#ifndef BENCH_RESIDENT_TOLERANCE
+#define BENCH_RESIDENT_TOLERANCE 0.25
+#endif
+#ifndef BENCH_ALLOCATED_TOLERANCE
+#define BENCH_ALLOCATED_TOLERANCE 0.05
+#endif
+#define BENCH_MEMORY_SLACK (1024.0 * 1024.0)
+#ifndef BENCH_PAUSE_TOLERANCE
+#define BENCH_PAUSE_TOLERANCE 0.25
+#endif
+#define BENCH_PAUSE_SLACK 0.0001  //Seconds
+
+//Runs the GC workloads headless, on a fresh VM each, and writes the
+//results to outPath as JSON. Workload sizes are multiplied by scale.
+//Returns false if a workload failed or regressed against baselinePath
+bool runBenchmarks(const char* outPath, const char* baselinePath, int scale);
+
+#endif
@@ -11,12 +11,16 @@ void initChunk(Chunk* chunk) {
     chunk->code = NULL;
     chunk->lines = NULL;
     initValueArray(&chunk->constants);
+    chunk->cacheCount = 0;
+    chunk->cacheCapacity = 0;
+    chunk->caches = NULL;
 }
 
 void freeChunk(Chunk* chunk){
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
     FREE_ARRAY(int, chunk->lines, chunk->capacity);
     freeValueArray(&chunk->constants);
+    FREE_ARRAY(InlineCache, chunk->caches, chunk->cacheCapacity);
     initChunk(chunk);
 }
 
@@ -43,3 +47,15 @@ int addConstant(Chunk* chunk, Value value){
     return chunk->constants.count - 1;
 }
 
+int addInlineCache(Chunk* chunk){
+    if (chunk->cacheCapacity < chunk->cacheCount + 1) {
+        int oldCapacity = chunk->cacheCapacity;
+        chunk->cacheCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->caches = GROW_ARRAY(InlineCache, chunk->caches, oldCapacity, chunk->cacheCapacity);
+    }
+
+    InlineCache* cache = &chunk->caches[chunk->cacheCount];
+    cache->count = 0;
+    cache->next = 0;
+    return chunk->cacheCount++;
+}
@@ -13,6 +13,7 @@ typedef enum {
     OP_JUMP_IF_FALSE, 
     OP_LOOP, 
     OP_CALL, 
+    OP_CALL_SCRATCH, //OP_CALL whose result dies with its stack slot
     OP_POST_INCREMENT,
     OP_POST_DECREMENT,
     OP_ADD, 
@@ -38,7 +39,19 @@ typedef enum {
     OP_DUP,
     OP_BUILD_ARRAY,
     OP_INDEX_GET,
-    OP_INDEX_SET
+    OP_INDEX_SET,
+    //variable.field = value, writes back so Vector2/Color fields can be set
+    OP_SET_LOCAL_PROPERTY,
+    OP_SET_GLOBAL_PROPERTY,
+    //Superinstructions, only ever produced by the peephole pass in the compiler
+    OP_LOCAL_LESS_CONST_JUMP,   //GET_LOCAL, CONSTANT, LESS, JUMP_IF_FALSE
+    OP_INC_LOCAL,               //GET_LOCAL, CONSTANT, ADD, SET_LOCAL, POP
+    OP_CALL_GLOBAL,             //GET_GLOBAL, CALL 0
+    //Quickened forms, run() swaps these in after seeing two number operands
+    OP_ADD_NUMBER,
+    OP_SUBTRACT_NUMBER,
+    OP_GREATER_NUMBER,
+    OP_LESS_NUMBER
 }OpCode;
 /*
     1. Allocate a new array with more capacity.
@@ -55,17 +68,37 @@ The code holds the Operation code like OP_RETURN, the constants hold the values
 When doing OP_CONSTANT it will show that then the index in the array that that value is in
 */
 
+#define INLINE_CACHE_WAYS 4
+
+struct Shape;
+
+//One per property access, remembers which slot the field was in for the last
+//few shapes seen there. transition is the shape a SET moves the instance to,
+//NULL when the field already existed
+typedef struct {
+    struct Shape* shapes[INLINE_CACHE_WAYS];
+    struct Shape* transitions[INLINE_CACHE_WAYS];
+    int indices[INLINE_CACHE_WAYS];
+    int count;
+    int next; //Entry to overwrite once every way is in use
+} InlineCache;
+
 typedef struct {
     int count;
     int capacity;
     uint8_t* code;
     int* lines;
     ValueArray constants;
+
+    int cacheCount;
+    int cacheCapacity;
+    InlineCache* caches;
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 void freeChunk(Chunk* chunk);
 int addConstant(Chunk* chunk, Value value);
+int addInlineCache(Chunk* chunk);
 
 #endif
\ No newline at end of file
@@ -6,15 +6,50 @@
 #include <stdint.h>
 #include <string.h>
 
+// #define NAN_BOXING
+
+//Computed gotos are a GCC/Clang extension, everything else uses the switch
+#if defined(__GNUC__) || defined(__clang__)
+#define THREADED_DISPATCH
+#endif
+
 #define DEBUG_PRINT_CODE 
 // #define DEBUG_TRACE_EXECUTION
 
+// #define DEBUG_INLINE_CACHE
+// #define DEBUG_LOG_PACER
+
 // #define DEBUG_STRESS_GC
 // #define DEBUG_LOG_GC
 
-#define DEBUG_MINOR_GC
+//Counts allocations per instruction and how many of them survive, printed
+//at exit and by allocationReport()
+// #define PROFILE_ALLOCATIONS
+
+//Major collections mark a slice at a time between frames and minors
+#define INCREMENTAL_GC
+
+//Runs the major mark on a background thread while the VM keeps going.
+//Needs NAN_BOXING so a Value is read and written in one load or store
+// #define CONCURRENT_MARK
+
+//Drains the gray stack of stop-the-world marks on several threads, see
+//GC_MARK_THREADS
+// #define PARALLEL_MARK
+
+//Young objects made during draw() go into an arena that is dropped
+//wholesale when the frame ends. The few that were stored somewhere outside
+//it are copied out first, see endFrameArena
+// #define FRAME_ARENA
+
+//Makes every collection a major one
+// #define DEBUG_MINOR_GC
 
 #define DEBUG_LOG_TIME
 #define UINT8_COUNT (UINT8_MAX + 1)
 
+#if defined(CONCURRENT_MARK) && (!defined(NAN_BOXING) || !defined(INCREMENTAL_GC))
+#error "CONCURRENT_MARK needs NAN_BOXING and INCREMENTAL_GC"
+#endif
+
 #endif
\ No newline at end of file
@@ -8,6 +8,7 @@
 
 
 #include "memory.h"
+#include "vm.h"
 #include "compiler.h"
 #include "scanner.h"
 
@@ -47,6 +48,10 @@ typedef struct {
     Token name;
     int depth;
     bool isCaptured;
+    //The call the local was initialised from, made a scratch call when the
+    //scope ends if the value never escaped. -1 if it wasn't a call
+    int scratchCall;
+    bool escapes;
 } Local;
 
 typedef enum {
@@ -66,6 +71,17 @@ typedef struct Compiler {
     Local locals[UINT8_COUNT];
     int localCount;
     int scopeDepth;
+
+    //Where the last plain variable read ended, dot() uses it to turn
+    //variable.field = value into a write back into the variable
+    int variableEnd;
+    uint8_t variableOp;
+    int variableArg;
+
+    //Where the last call was emitted and where the current call argument
+    //started, for finding values that are used up by a native call
+    int lastCall;
+    int argumentStart;
 } Compiler;
 
 
@@ -80,7 +96,7 @@ Compiler* current = NULL;
 static uint8_t argumentList();
 static void declaration();
 static void varDeclaration();
-static uint8_t parseVariable(const char* errorMessage);
+static uint16_t parseVariable(const char* errorMessage);
 static void namedVariable(Token name, bool canAssign);
 static void markInitialized();
 static void statement();
@@ -104,10 +120,26 @@ static void beginScope() {
     current->scopeDepth++;
 }
 
+//True if the value the last expression left on the stack came from a call
+static bool endsInCall() {
+    return current->lastCall != -1 && current->lastCall == currentChunk()->count - 2;
+}
+
+static void makeScratchCall(int offset) {
+    if (offset != -1) currentChunk()->code[offset] = OP_CALL_SCRATCH;
+}
+
+//A local made by a call that was only ever used up in place can have its
+//Vector2 built in the stack slot's scratch cell instead of the heap
+static void releaseLocal(Local* local) {
+    if (!local->escapes) makeScratchCall(local->scratchCall);
+}
+
 static void endScope() {
     current->scopeDepth--;
 
     while (current->localCount > 0 && current->locals[current->localCount - 1].depth > current->scopeDepth) {
+        releaseLocal(&current->locals[current->localCount - 1]);
         emitByte(OP_POP);
         current->localCount--;
     }
@@ -125,6 +157,9 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
     compiler->type = type;
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
+    compiler->variableEnd = -1;
+    compiler->lastCall = -1;
+    compiler->argumentStart = -1;
     compiler->function = newFunction();
     current = compiler;
 
@@ -135,6 +170,8 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
     Local* local = &current->locals[current->localCount++];
     local->depth = 0;
     local->isCaptured = false;
+    local->scratchCall = -1;
+    local->escapes = false;
 
     if (type != TYPE_FUNCTION) {
         local->name.start = "this";
@@ -155,14 +192,26 @@ static int getInstructionLength(uint8_t instruction) {
             return 1;
             
 
-        case OP_CONSTANT: case OP_GET_GLOBAL: case OP_SET_GLOBAL:
-        case OP_GET_LOCAL: case OP_SET_LOCAL: case OP_GET_PROPERTY:
-        case OP_SET_PROPERTY: case OP_ENTITY: case OP_DEFINE_GLOBAL: case OP_CALL: 
+        case OP_CONSTANT:
+        case OP_GET_LOCAL: case OP_SET_LOCAL: case OP_ENTITY: case OP_CALL: 
+        case OP_CALL_SCRATCH:
+        case OP_BUILD_ARRAY:
             return 2;
             
       
         case OP_JUMP: case OP_JUMP_IF_FALSE: case OP_LOOP:
+        case OP_INC_LOCAL: case OP_GET_GLOBAL: case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL: case OP_CALL_GLOBAL:
             return 3;
+
+        case OP_GET_PROPERTY: case OP_SET_PROPERTY:
+            return 4;
+
+        case OP_LOCAL_LESS_CONST_JUMP: case OP_SET_LOCAL_PROPERTY:
+            return 5;
+
+        case OP_SET_GLOBAL_PROPERTY:
+            return 6;
             
         default:
             return 1; 
@@ -203,14 +252,131 @@ static void optimizeJumps(Chunk* chunk) {
     }
 }
 
+static bool isJumpInstruction(uint8_t instruction) {
+    return instruction == OP_JUMP || instruction == OP_JUMP_IF_FALSE || 
+            instruction == OP_LOOP || instruction == OP_LOCAL_LESS_CONST_JUMP;
+}
+
+//Where a jump lands, the offset is always in the last 2 bytes of the instruction
+static int jumpTarget(Chunk* chunk, int offset) {
+    uint8_t instruction = chunk->code[offset];
+    int length = getInstructionLength(instruction);
+    int jump = (chunk->code[offset + length - 2] << 8) | chunk->code[offset + length - 1];
+    return instruction == OP_LOOP ? offset + length - jump : offset + length + jump;
+}
+
+static bool matchSequence(Chunk* chunk, bool* isTarget, int offset, 
+                                const uint8_t* sequence, int length) {
+    for (int i = 0; i < length; i++) {
+        if (offset >= chunk->count || chunk->code[offset] != sequence[i]) return false;
+        //Something jumps into the middle, the pieces have to stay separate
+        if (i > 0 && isTarget[offset]) return false;
+        offset += getInstructionLength(sequence[i]);
+    }
+    return true;
+}
+
+/*
+Fuses the sequences that show up in every counting loop into one instruction.
+The code only ever shrinks, so it is rewritten in place and every jump is 
+re-pointed through a map of old offset -> new offset at the end.
+*/
+static void fuseSuperinstructions(Chunk* chunk) {
+    static const uint8_t lessJump[] = {OP_GET_LOCAL, OP_CONSTANT, OP_LESS, OP_JUMP_IF_FALSE};
+    static const uint8_t incLocal[] = {OP_GET_LOCAL, OP_CONSTANT, OP_ADD, OP_SET_LOCAL, OP_POP};
+    static const uint8_t callGlobal[] = {OP_GET_GLOBAL, OP_CALL};
+
+    int count = chunk->count;
+    bool* isTarget = ALLOCATE(bool, count + 1);
+    int* newOffset = ALLOCATE(int, count + 1);
+    int* oldTarget = ALLOCATE(int, count + 1);
+    memset(isTarget, 0, sizeof(bool) * (count + 1));
+
+    for (int i = 0; i < count; i += getInstructionLength(chunk->code[i])) {
+        if (isJumpInstruction(chunk->code[i])) {
+            isTarget[jumpTarget(chunk, i)] = true;
+        }
+    }
+
+    int read = 0;
+    int write = 0;
+    while (read < count) {
+        uint8_t* code = &chunk->code[read];
+        int line = chunk->lines[read];
+        int oldLength;
+        int newLength;
+        newOffset[read] = write;
+
+        if (matchSequence(chunk, isTarget, read, lessJump, 4)) {
+            // [GET_LOCAL a][CONSTANT k][LESS][JUMP_IF_FALSE hi lo]
+            oldTarget[write] = jumpTarget(chunk, read + 5);
+            uint8_t fused[] = {OP_LOCAL_LESS_CONST_JUMP, code[1], code[3], 0, 0};
+            oldLength = 8;
+            newLength = 5;
+            memcpy(&chunk->code[write], fused, newLength);
+        }
+        else if (matchSequence(chunk, isTarget, read, incLocal, 5) && code[1] == code[6]) {
+            // [GET_LOCAL a][CONSTANT k][ADD][SET_LOCAL a][POP]
+            uint8_t fused[] = {OP_INC_LOCAL, code[1], code[3]};
+            oldLength = 8;
+            newLength = 3;
+            memcpy(&chunk->code[write], fused, newLength);
+        }
+        else if (matchSequence(chunk, isTarget, read, callGlobal, 2) && code[4] == 0) {
+            // [GET_GLOBAL hi lo][CALL 0]
+            uint8_t fused[] = {OP_CALL_GLOBAL, code[1], code[2]};
+            oldLength = 5;
+            newLength = 3;
+            memcpy(&chunk->code[write], fused, newLength);
+        }
+        else {
+            oldLength = newLength = getInstructionLength(code[0]);
+            if (isJumpInstruction(code[0])) oldTarget[write] = jumpTarget(chunk, read);
+            memmove(&chunk->code[write], code, newLength);
+        }
+
+        //Inner offsets of a fused sequence are never jump targets
+        for (int i = 1; i < oldLength; i++) newOffset[read + i] = write;
+        for (int i = 0; i < newLength; i++) chunk->lines[write + i] = line;
+
+        read += oldLength;
+        write += newLength;
+    }
+    newOffset[count] = write;
+    chunk->count = write;
+
+    for (int i = 0; i < chunk->count; i += getInstructionLength(chunk->code[i])) {
+        uint8_t instruction = chunk->code[i];
+        if (!isJumpInstruction(instruction)) continue;
+
+        int length = getInstructionLength(instruction);
+        int target = newOffset[oldTarget[i]];
+        int jump = instruction == OP_LOOP ? i + length - target : target - i - length;
+        chunk->code[i + length - 2] = (jump >> 8) & 0xff;
+        chunk->code[i + length - 1] = jump & 0xff;
+    }
+
+    FREE_ARRAY(int, oldTarget, count + 1);
+    FREE_ARRAY(int, newOffset, count + 1);
+    FREE_ARRAY(bool, isTarget, count + 1);
+}
+
 static ObjFunction* endCompiler(){
     emitReturn();
     ObjFunction* function = current->function; 
 
-    #ifdef DEBUG_PRINT_CODE
-        if (!parser.hadError) {
-            optimizeJumps(&function->chunk);
+    //The function's own scope is never ended
+    for (int i = 0; i < current->localCount; i++) {
+        releaseLocal(&current->locals[i]);
+    }
 
+    if (!parser.hadError) {
+        optimizeJumps(&function->chunk);
+        fuseSuperinstructions(&function->chunk);
+    }
+
+    #ifdef DEBUG_PRINT_CODE
+        if (!parser.hadError && !vm.quiet) {
             disassembleChunk(currentChunk(), function->name != NULL ? 
                                         function->name->chars : "<script>");
         }
@@ -299,6 +465,16 @@ static uint8_t identifierConstant(Token* name){
     return makeConstant(C_TO_OBJ_VALUE(copyString(name->start, name->length)));
 }
 
+//Globals live in a VM wide slot array, the name only matters while compiling
+static uint16_t identifierGlobal(Token* name){
+    int slot = globalSlot(copyString(name->start, name->length));
+    if (slot > UINT16_MAX) {
+        error("Too many global variables.");
+        return 0;
+    }
+    return (uint16_t)slot;
+}
+
 static Token syntheticToken(const char* text) {
     Token token;
     token.start = text;
@@ -320,6 +496,37 @@ static void emitBytes(uint8_t byte1, uint8_t byte2){
     emitByte(byte2);
 }
 
+static void emitShort(uint16_t value){
+    emitByte((value >> 8) & 0xff);
+    emitByte(value & 0xff);
+}
+
+//Locals take a one byte stack slot, globals a two byte global slot
+static void emitVariable(uint8_t op, int arg){
+    emitByte(op);
+    if (op == OP_GET_GLOBAL || op == OP_SET_GLOBAL || op == OP_DEFINE_GLOBAL ||
+        op == OP_SET_GLOBAL_PROPERTY) {
+        emitShort((uint16_t)arg);
+    } else {
+        emitByte((uint8_t)arg);
+    }
+}
+
+//Property accesses carry the name and their own inline cache slot
+static void emitPropertyOperands(uint8_t name){
+    int cache = addInlineCache(currentChunk());
+    if (cache > UINT16_MAX) {
+        error("Too many property accesses in one function.");
+    }
+    emitByte(name);
+    emitShort((uint16_t)cache);
+}
+
+static void emitProperty(uint8_t op, uint8_t name){
+    emitByte(op);
+    emitPropertyOperands(name);
+}
+
 static int emitJump(uint8_t instruction) {
     emitByte(instruction);
     emitByte(0xff);
@@ -416,34 +623,61 @@ static void parsePrecedence(Precedence precedence){
 }
 
 static void dot(bool canAssign) {
+    int receiverCall = endsInCall() ? current->lastCall : -1;
     consume(TOKEN_IDENTIFIER, "Expect property name after '.'");
     uint8_t name = identifierConstant(&parser.previous);
 
-    if (canAssign && match(TOKEN_EQUAL)) {
+    bool isVariable = current->variableEnd == currentChunk()->count;
+    if (isVariable && canAssign && 
+        (check(TOKEN_EQUAL) || check(TOKEN_PLUS_EQUAL) || check(TOKEN_MINUS_EQUAL))) {
+        //Drop the variable read, the fused set reads (and writes back) the variable itself
+        uint8_t getOp = current->variableOp;
+        int arg = current->variableArg;
+        currentChunk()->count -= getOp == OP_GET_LOCAL ? 2 : 3;
+        current->variableEnd = -1;
+
+        if (match(TOKEN_EQUAL)) {
+            expression();
+        }
+        else {
+            bool isAdd = match(TOKEN_PLUS_EQUAL);
+            if (!isAdd) match(TOKEN_MINUS_EQUAL);
+            emitVariable(getOp, arg);
+            emitProperty(OP_GET_PROPERTY, name);
+            expression();
+            emitByte(isAdd ? OP_ADD : OP_SUBTRACT);
+        }
+        emitVariable(getOp == OP_GET_LOCAL ? OP_SET_LOCAL_PROPERTY : OP_SET_GLOBAL_PROPERTY, arg);
+        emitPropertyOperands(name);
+    }
+    else if (canAssign && match(TOKEN_EQUAL)) {
         expression();
-        emitBytes(OP_SET_PROPERTY, name);
+        emitProperty(OP_SET_PROPERTY, name);
     } 
     else if (canAssign && match(TOKEN_PLUS_EQUAL)) {
         emitByte(OP_DUP); // Duplicate the instance
-        emitBytes(OP_GET_PROPERTY, name);
+        emitProperty(OP_GET_PROPERTY, name);
         expression();
         emitByte(OP_ADD);
-        emitBytes(OP_SET_PROPERTY, name);
+        emitProperty(OP_SET_PROPERTY, name);
     }
     else if (canAssign && match(TOKEN_MINUS_EQUAL)) {
         emitByte(OP_DUP); // Duplicate the instance
-        emitBytes(OP_GET_PROPERTY, name);
+        emitProperty(OP_GET_PROPERTY, name);
         expression();
         emitByte(OP_SUBTRACT);
-        emitBytes(OP_SET_PROPERTY, name);
+        emitProperty(OP_SET_PROPERTY, name);
     }
     else {
-        emitBytes(OP_GET_PROPERTY, name);
+        //Reading a field uses the receiver up
+        makeScratchCall(receiverCall);
+        emitProperty(OP_GET_PROPERTY, name);
     }
 }
 
 static void call (bool canAssign) {
     uint8_t argCount = argumentList();
+    current->lastCall = currentChunk()->count;
     emitBytes(OP_CALL, argCount);
 }
 
@@ -454,9 +688,11 @@ static void grouping(bool canAssign){
 
 static void binary(bool canAssign) {
     TokenType operatorType = parser.previous.type;
+    int leftCall = endsInCall() ? current->lastCall : -1;
 
     ParseRule* rule = getRule(operatorType);
     parsePrecedence((Precedence)(rule->precedence + 1));
+    int rightCall = endsInCall() ? current->lastCall : -1;
 
     switch(operatorType) {
         case TOKEN_NOT_EQUAL:  emitBytes(OP_EQUAL, OP_NOT); break;
@@ -471,6 +707,9 @@ static void binary(bool canAssign) {
         case TOKEN_SLASH:       emitByte(OP_DIVIDE); break;
         default: return; 
     }
+    //Both operands are used up by the operator
+    makeScratchCall(leftCall);
+    makeScratchCall(rightCall);
 }
 
 static void unary(bool canAssign) {
@@ -505,6 +744,8 @@ static void literal(bool canAssign) {
 
 static void array(bool canAssign) {
     int itemCount = 0;
+    //An element is stored in the array, not used up like an argument
+    current->argumentStart = -1;
     if (!check(TOKEN_RIGHT_BRACKET)) {
         do {
             expression();
@@ -811,7 +1052,7 @@ static void statement() {
 ---------------------------------------------------------------------------
 */
 static void declareVariable();
-static void defineVariable(uint8_t global);
+static void defineVariable(uint16_t global);
 
 static void function(FunctionType type) {
     Compiler compiler;
@@ -827,7 +1068,7 @@ static void function(FunctionType type) {
                 errorAtCurrent("Can't have more than 255 parameters.");
             }
 
-            uint8_t paramConstant = parseVariable("Expect parameter name.");
+            uint16_t paramConstant = parseVariable("Expect parameter name.");
             defineVariable(paramConstant);
         } while (match(TOKEN_COMMA));
     }
@@ -847,7 +1088,11 @@ static uint8_t argumentList() {
     uint8_t argCount = 0;
     if (!check(TOKEN_RIGHT_PAREN)) {
         do {
+            current->argumentStart = currentChunk()->count;
             expression();
+            //The argument dies with the call, natives never keep their
+            //arguments and calls to script functions copy scratch ones
+            if (endsInCall()) makeScratchCall(current->lastCall);
             if (argCount == 255) {
                 error("Can't have more than 255 arguments.");
             }
@@ -862,10 +1107,15 @@ static uint8_t argumentList() {
 static void entityDeclaration() {
     consume(TOKEN_IDENTIFIER, "Expect entity name.");
     uint8_t nameConstant = identifierConstant(&parser.previous);
+    uint16_t global = 0;
+    if (current->scopeDepth == 0 || 
+        (current->type == TYPE_SETUP && current->scopeDepth == 1)) {
+        global = identifierGlobal(&parser.previous);
+    }
     declareVariable();
 
     emitBytes(OP_ENTITY, nameConstant);
-    defineVariable(nameConstant);
+    defineVariable(global);
 
     consume(TOKEN_LEFT_BRACE, "Expect '{' before entity body.");
     consume(TOKEN_RIGHT_BRACE, "Expect '}' after entity body.");
@@ -878,7 +1128,7 @@ static void functionDeclaration() {
         errorAtCurrent("Can't declare a function in a nested scope.");
     }
 
-    uint8_t global = parseVariable("Expect function name.");
+    uint16_t global = parseVariable("Expect function name.");
     markInitialized();
 
     Token* name = &parser.previous;
@@ -890,7 +1140,7 @@ static void functionDeclaration() {
 
     //RUN THE SETUP FUNCTION
     if (current->type == TYPE_SCRIPT && isSetup) {
-        emitBytes(OP_GET_GLOBAL, global); 
+        emitVariable(OP_GET_GLOBAL, global); 
         emitBytes(OP_CALL, 0);             
         emitByte(OP_POP);                  
     }
@@ -909,7 +1159,7 @@ static void markInitialized() {
     current->locals[current->localCount - 1].depth = current->scopeDepth;
 }
 
-static void defineVariable(uint8_t global) {
+static void defineVariable(uint16_t global) {
     bool isGlobal = false;
 
     if (current->scopeDepth == 0) {
@@ -923,7 +1173,7 @@ static void defineVariable(uint8_t global) {
 
 
     if (isGlobal) {
-        emitBytes(OP_DEFINE_GLOBAL, global);
+        emitVariable(OP_DEFINE_GLOBAL, global);
     } else {
         // Local variable on stack, mark init for use
         markInitialized();
@@ -940,6 +1190,8 @@ static void addLocal(Token name) {
     local->name = name;
     local->depth = -1;
     local->isCaptured = false;
+    local->scratchCall = -1;
+    local->escapes = false;
 }
 
 static int resolveLocal(Compiler* compiler, Token* name) {
@@ -973,6 +1225,26 @@ static void declareVariable(){
     addLocal(*name);
 }
 
+//A read is safe when the value is used up on the spot, by a field access,
+//an operator or as a whole call argument. Anything else could store it
+//somewhere that outlives the local
+static void noteLocalRead(Local* local, int start) {
+    switch (parser.current.type) {
+        case TOKEN_DOT:
+        case TOKEN_PLUS: case TOKEN_MINUS: case TOKEN_STAR: case TOKEN_SLASH:
+        case TOKEN_EQUAL_EQUAL: case TOKEN_NOT_EQUAL:
+        case TOKEN_GREATER: case TOKEN_GREATER_EQUAL:
+        case TOKEN_LESS: case TOKEN_LESS_EQUAL:
+            return;
+        case TOKEN_COMMA: case TOKEN_RIGHT_PAREN:
+            if (start == current->argumentStart) return;
+            break;
+        default:
+            break;
+    }
+    local->escapes = true;
+}
+
 static void namedVariable(Token name, bool canAssign){
     uint8_t getOp, setOp;
     int arg = resolveLocal(current, &name);
@@ -981,45 +1253,51 @@ static void namedVariable(Token name, bool canAssign){
         setOp = OP_SET_LOCAL;
     }
     else{
-        arg = identifierConstant(&name);
+        arg = identifierGlobal(&name);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
     //TODO: See if the += and stuff work with Strings :D
     if (canAssign && match(TOKEN_EQUAL)) {
+        current->argumentStart = -1;
         expression();
-        emitBytes(setOp, (uint8_t)arg);
+        emitVariable(setOp, arg);
     } 
     else if (canAssign && match(TOKEN_PLUS_EQUAL)) {
-        emitBytes(getOp, (uint8_t)arg);
+        emitVariable(getOp, arg);
         expression();                     
         emitByte(OP_ADD);                 
-        emitBytes(setOp, (uint8_t)arg); 
+        emitVariable(setOp, arg); 
     } 
     else if (canAssign && match(TOKEN_MINUS_EQUAL)) {
-        emitBytes(getOp, (uint8_t)arg);
+        emitVariable(getOp, arg);
         expression();
         emitByte(OP_SUBTRACT);
-        emitBytes(setOp, (uint8_t)arg);
+        emitVariable(setOp, arg);
     } 
     else if (canAssign && match(TOKEN_STAR_EQUAL)) {
-        emitBytes(getOp, (uint8_t)arg);
+        emitVariable(getOp, arg);
         expression();
         emitByte(OP_MULTIPLY);
-        emitBytes(setOp, (uint8_t)arg);
+        emitVariable(setOp, arg);
     } 
     else if (canAssign && match(TOKEN_SLASH_EQUAL)) {
-        emitBytes(getOp, (uint8_t)arg);
+        emitVariable(getOp, arg);
         expression();
         emitByte(OP_DIVIDE);
-        emitBytes(setOp, (uint8_t)arg);
+        emitVariable(setOp, arg);
     } 
     else {
-        emitBytes(getOp, (uint8_t)arg);
+        int start = currentChunk()->count;
+        emitVariable(getOp, arg);
+        if (getOp == OP_GET_LOCAL) noteLocalRead(&current->locals[arg], start);
+        current->variableEnd = currentChunk()->count;
+        current->variableOp = getOp;
+        current->variableArg = arg;
     }
 }
 
-static uint8_t parseVariable(const char* errorMessage) {
+static uint16_t parseVariable(const char* errorMessage) {
     consume(TOKEN_IDENTIFIER, errorMessage);
 
     declareVariable();
@@ -1032,16 +1310,20 @@ static uint8_t parseVariable(const char* errorMessage) {
         //Dummy index for locals
         return 0;
     } else {
-        //Global index for globals
-        return identifierConstant(&parser.previous);
+        //Global slot for globals
+        return identifierGlobal(&parser.previous);
     }
 }
 
 static void varDeclaration() {
-    uint8_t global = parseVariable("Expect variable name.");
+    int localCount = current->localCount;
+    uint16_t global = parseVariable("Expect variable name.");
 
     if (match(TOKEN_EQUAL)) {
         expression();
+        if (current->localCount > localCount && endsInCall()) {
+            current->locals[current->localCount - 1].scratchCall = current->lastCall;
+        }
     }
     else{
         emitByte(OP_NULL);
@@ -1106,7 +1388,7 @@ ObjFunction* compile(const char* source) {
 void markCompilerRoots(bool isMajor) {
     Compiler* compiler = current;
     while (compiler != NULL) {
-        markObject((Obj*)compiler->function, isMajor);
+        MARK_OBJECT(compiler->function, isMajor);
         compiler = compiler->enclosing;
     }
 }
\ No newline at end of file
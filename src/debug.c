@@ -2,6 +2,7 @@
 #include "debug.h"
 #include "value.h"
 #include "object.h"
+#include "vm.h"
 
 void disassembleChunk(Chunk* chunk, const char* name){
     printf("== %s ==\n", name);
@@ -37,6 +38,39 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset){
     
 }
 
+static int globalInstruction(const char* name, Chunk* chunk, int offset) {
+    uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+    slot |= chunk->code[offset + 2];
+    printf("%-16s %4d '", name, slot);
+    if (slot < vm.globalIdentifiers.count) {
+        printValue(vm.globalIdentifiers.values[slot]);
+    }
+    printf("'\n");
+    return offset + 3;
+}
+
+static int propertyInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t constant = chunk->code[offset + 1];
+    uint16_t cache = (uint16_t)(chunk->code[offset + 2] << 8);
+    cache |= chunk->code[offset + 3];
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' ic %d\n", cache);
+    return offset + 4;
+}
+
+static int variablePropertyInstruction(const char* name, Chunk* chunk, int offset, int slotBytes) {
+    int slot = chunk->code[offset + 1];
+    if (slotBytes == 2) slot = (slot << 8) | chunk->code[offset + 2];
+    uint8_t constant = chunk->code[offset + 1 + slotBytes];
+    uint16_t cache = (uint16_t)(chunk->code[offset + 2 + slotBytes] << 8);
+    cache |= chunk->code[offset + 3 + slotBytes];
+    printf("%-16s %4d '", name, slot);
+    printValue(chunk->constants.values[constant]);
+    printf("' ic %d\n", cache);
+    return offset + 4 + slotBytes;
+}
+
 static int byteInstruction(const char* name, Chunk* chunk, int offset) {
     uint8_t slot = chunk->code[offset + 1];
     printf("%-16s %4d\n", name, slot);
@@ -50,6 +84,26 @@ static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset)
     return offset + 3;
 }
 
+static int localConstantInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    uint8_t constant = chunk->code[offset + 2];
+    printf("%-16s %4d '", name, slot);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+}
+
+static int localConstantJumpInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    uint8_t constant = chunk->code[offset + 2];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 3] << 8);
+    jump |= chunk->code[offset + 4];
+    printf("%-16s %4d '", name, slot);
+    printValue(chunk->constants.values[constant]);
+    printf("' -> %d\n", offset + 5 + jump);
+    return offset + 5;
+}
+
 static int invokeInstruction(const char* name, Chunk* chunk, int offset) {
     uint8_t constant = chunk->code[offset + 1];
     uint8_t argCount = chunk->code[offset + 2];
@@ -75,11 +129,11 @@ int disassembleInstruction(Chunk* chunk, int offset){
         case OP_CONSTANT:
             return constantInstruction("OP_CONSTANT", chunk, offset);
         case OP_DEFINE_GLOBAL:
-            return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+            return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
         case OP_GET_GLOBAL:
-            return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+            return globalInstruction("OP_GET_GLOBAL", chunk, offset);
         case OP_SET_GLOBAL:
-            return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+            return globalInstruction("OP_SET_GLOBAL", chunk, offset);
         case OP_NULL:
             return simpleInstruction("OP_NULL", offset);
         case OP_TRUE:
@@ -96,12 +150,20 @@ int disassembleInstruction(Chunk* chunk, int offset){
             return simpleInstruction("OP_EQUAL", offset);
         case OP_GREATER:
             return simpleInstruction("OP_GREATER", offset);
+        case OP_GREATER_NUMBER:
+            return simpleInstruction("OP_GREATER_NUMBER", offset);
         case OP_LESS:
             return simpleInstruction("OP_LESS", offset);
+        case OP_LESS_NUMBER:
+            return simpleInstruction("OP_LESS_NUMBER", offset);
         case OP_ADD:
             return simpleInstruction("OP_ADD", offset);
+        case OP_ADD_NUMBER:
+            return simpleInstruction("OP_ADD_NUMBER", offset);
         case OP_SUBTRACT:
             return simpleInstruction("OP_SUBTRACT", offset);
+        case OP_SUBTRACT_NUMBER:
+            return simpleInstruction("OP_SUBTRACT_NUMBER", offset);
         case OP_MULTIPLY:
             return simpleInstruction("OP_MULTIPLY", offset);
         case OP_DIVIDE:
@@ -120,12 +182,18 @@ int disassembleInstruction(Chunk* chunk, int offset){
             return jumpInstruction("OP_LOOP", -1, chunk, offset);
         case OP_CALL:
             return byteInstruction("OP_CALL", chunk, offset);
+        case OP_CALL_SCRATCH:
+            return byteInstruction("OP_CALL_SCRATCH", chunk, offset);
         case OP_ENTITY:
             return constantInstruction("OP_ENTITY", chunk, offset);
         case OP_GET_PROPERTY:
-            return constantInstruction("OP_GET_PROPERTY", chunk, offset);
+            return propertyInstruction("OP_GET_PROPERTY", chunk, offset);
         case OP_SET_PROPERTY:
-            return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+            return propertyInstruction("OP_SET_PROPERTY", chunk, offset);
+        case OP_SET_LOCAL_PROPERTY:
+            return variablePropertyInstruction("OP_SET_LOCAL_PROPERTY", chunk, offset, 1);
+        case OP_SET_GLOBAL_PROPERTY:
+            return variablePropertyInstruction("OP_SET_GLOBAL_PROPERTY", chunk, offset, 2);
         //TODO: FIX THE CLOSURE AND INVOKE
         // case OP_INVOKE:
         //     return invokeInstruction("OP_INVOKE", chunk, offset);
@@ -145,6 +213,12 @@ int disassembleInstruction(Chunk* chunk, int offset){
 
         //     return offset;
         // }
+        case OP_LOCAL_LESS_CONST_JUMP:
+            return localConstantJumpInstruction("OP_LOCAL_LESS_CONST_JUMP", chunk, offset);
+        case OP_INC_LOCAL:
+            return localConstantInstruction("OP_INC_LOCAL", chunk, offset);
+        case OP_CALL_GLOBAL:
+            return globalInstruction("OP_CALL_GLOBAL", chunk, offset);
         case OP_POST_INCREMENT:
             return simpleInstruction("OP_POST_INCREMENT", offset);
         case OP_POST_DECREMENT:
@@ -0,0 +1,112 @@
+#include <string.h>
+
+#include "gclog.h"
+#include "vm.h"
+
+static const char* kindNames[] = {
+    [GC_EVENT_MINOR] = "minor",
+    [GC_EVENT_MAJOR] = "major",
+    [GC_EVENT_MARK_START] = "mark_start",
+    [GC_EVENT_MARK_SLICE] = "mark_slice",
+    [GC_EVENT_SWEEP] = "sweep",
+    [GC_EVENT_FRAME] = "frame",
+};
+
+void initGCLog(GCLog* log) {
+    memset(log, 0, sizeof(GCLog));
+    clock_gettime(CLOCK_MONOTONIC, &log->startTime);
+}
+
+static double logTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - vm.gcLog.startTime.tv_sec) +
+           (now.tv_nsec - vm.gcLog.startTime.tv_nsec) / 1e9;
+}
+
+static size_t youngBytes() {
+    size_t bytes = vm.bytesAllocated;
+    #ifdef FRAME_ARENA
+    bytes += vm.frameArenaTop - vm.frameArena;
+    #endif
+    return bytes;
+}
+
+void beginGCEvent(GCEvent* event, GCEventKind kind) {
+    event->kind = kind;
+    event->start = logTime();
+    event->youngBefore = youngBytes();
+    event->oldBefore = vm.bytesAllocatedTenure;
+    event->promoted = vm.gcLog.promoted;
+}
+
+void endGCEvent(GCEvent* event) {
+    GCLog* log = &vm.gcLog;
+    event->end = logTime();
+    event->youngAfter = youngBytes();
+    event->oldAfter = vm.bytesAllocatedTenure;
+    event->promoted = log->promoted - event->promoted;
+    event->remSetSize = vm.remSet.count;
+
+    double pause = event->end - event->start;
+    log->totalPause += pause;
+    if (pause > log->worstPause) log->worstPause = pause;
+    log->kindCounts[event->kind]++;
+    log->events[log->count % GC_LOG_SIZE] = *event;
+    log->count++;
+}
+
+//Oldest first
+static GCEvent* eventAt(size_t index) {
+    size_t first = vm.gcLog.count > GC_LOG_SIZE ? vm.gcLog.count - GC_LOG_SIZE : 0;
+    return &vm.gcLog.events[(first + index) % GC_LOG_SIZE];
+}
+
+static size_t keptEvents() {
+    return vm.gcLog.count < GC_LOG_SIZE ? vm.gcLog.count : GC_LOG_SIZE;
+}
+
+void writeGCLogJSON(FILE* file) {
+    size_t kept = keptEvents();
+    fprintf(file, "{\"dropped\": %zu, \"events\": [\n", vm.gcLog.count - kept);
+    for (size_t i = 0; i < kept; i++) {
+        GCEvent* event = eventAt(i);
+        fprintf(file, "  {\"kind\": \"%s\", \"start\": %.6f, \"end\": %.6f, "
+                "\"pause\": %.6f, \"youngBefore\": %zu, \"youngAfter\": %zu, "
+                "\"oldBefore\": %zu, \"oldAfter\": %zu, \"promoted\": %zu, "
+                "\"remSet\": %d}%s\n",
+                kindNames[event->kind], event->start, event->end,
+                event->end - event->start, event->youngBefore, event->youngAfter,
+                event->oldBefore, event->oldAfter, event->promoted,
+                event->remSetSize, i + 1 < kept ? "," : "");
+    }
+    fprintf(file, "]}\n");
+}
+
+void writeGCLogCSV(FILE* file) {
+    fprintf(file, "kind,start,end,pause,young_before,young_after,"
+                  "old_before,old_after,promoted,remset\n");
+    for (size_t i = 0; i < keptEvents(); i++) {
+        GCEvent* event = eventAt(i);
+        fprintf(file, "%s,%.6f,%.6f,%.6f,%zu,%zu,%zu,%zu,%zu,%d\n",
+                kindNames[event->kind], event->start, event->end,
+                event->end - event->start, event->youngBefore, event->youngAfter,
+                event->oldBefore, event->oldAfter, event->promoted,
+                event->remSetSize);
+    }
+}
+
+//CSV when the path ends in .csv, JSON otherwise
+bool writeGCLog(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return false;
+
+    size_t length = strlen(path);
+    if (length >= 4 && strcmp(path + length - 4, ".csv") == 0) {
+        writeGCLogCSV(file);
+    } else {
+        writeGCLogJSON(file);
+    }
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef graphiC_gclog_h
+#define graphiC_gclog_h
+
+#include <stdio.h>
+#include <time.h>
+
+#include "common.h"
+
+//How many of the latest events are kept, older ones are overwritten
+#ifndef GC_LOG_SIZE
+#define GC_LOG_SIZE 1024
+#endif
+
+typedef enum {
+    GC_EVENT_MINOR,
+    GC_EVENT_MAJOR,      //Stop-the-world major, or the pause finishing a mark
+    GC_EVENT_MARK_START, //Promotes everything young and marks the roots
+    GC_EVENT_MARK_SLICE,
+    GC_EVENT_SWEEP,      //Lazy sweep run between frames
+    GC_EVENT_FRAME,      //Frame arena dropped at the end of draw()
+    GC_EVENT_KIND_COUNT
+} GCEventKind;
+
+//One pause. Times are seconds since the VM started, sizes are bytes. The
+//old generation is only known exactly once the lazy sweep is done
+typedef struct {
+    GCEventKind kind;
+    double start;
+    double end;
+    size_t youngBefore;
+    size_t youngAfter;
+    size_t oldBefore;
+    size_t oldAfter;
+    size_t promoted;
+    int remSetSize;      //Entries once the pause is over
+} GCEvent;
+
+typedef struct {
+    GCEvent events[GC_LOG_SIZE];
+    size_t count;        //Ever logged, events[count % GC_LOG_SIZE] is next
+    size_t kindCounts[GC_EVENT_KIND_COUNT];
+    double totalPause;
+    double worstPause;
+    size_t promoted;     //Bytes copied into the old generation so far
+    size_t allocations;  //Objects made so far, and their bytes
+    size_t allocatedBytes;
+    struct timespec startTime;
+} GCLog;
+
+void initGCLog(GCLog* log);
+void beginGCEvent(GCEvent* event, GCEventKind kind);
+void endGCEvent(GCEvent* event);
+void writeGCLogJSON(FILE* file);
+void writeGCLogCSV(FILE* file);
+bool writeGCLog(const char* path);
+
+#endif
@@ -0,0 +1,709 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "heapdump.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+#define DUMP_MAGIC "GCDUMP01"
+#define LABEL_MAX 40
+
+typedef struct {
+    int object;
+    RootKind kind;
+} DumpRoot;
+
+//Objects get ids in the order the walk finds them. Nothing is collected or
+//moved while the dump is taken, so addresses are stable keys
+typedef struct {
+    Obj** objects;
+    int count;
+    int capacity;
+
+    Obj** keys;
+    int* ids;
+    int tableCapacity;
+
+    DumpRoot* roots;
+    int rootCount;
+    int rootCapacity;
+
+    //References of the object being looked at
+    Obj** references;
+    int referenceCount;
+    int referenceCapacity;
+} HeapDump;
+
+static void* growBuffer(void* buffer, int* capacity, size_t size) {
+    *capacity = GROW_CAPACITY(*capacity);
+    buffer = realloc(buffer, size * *capacity);
+    if (buffer == NULL) exit(1);
+    return buffer;
+}
+
+static uint32_t hashPointer(Obj* object) {
+    return (uint32_t)(((uintptr_t)object >> 3) * 2654435761u);
+}
+
+static void growTable(HeapDump* dump) {
+    free(dump->keys);
+    free(dump->ids);
+    dump->tableCapacity = dump->tableCapacity == 0 ? 1024 : dump->tableCapacity * 2;
+    dump->keys = (Obj**)calloc(dump->tableCapacity, sizeof(Obj*));
+    dump->ids = (int*)malloc(sizeof(int) * dump->tableCapacity);
+    if (dump->keys == NULL || dump->ids == NULL) exit(1);
+
+    for (int id = 0; id < dump->count; id++) {
+        uint32_t index = hashPointer(dump->objects[id]) & (dump->tableCapacity - 1);
+        while (dump->keys[index] != NULL) index = (index + 1) & (dump->tableCapacity - 1);
+        dump->keys[index] = dump->objects[id];
+        dump->ids[index] = id;
+    }
+}
+
+//The object's id, giving it the next one the first time it is seen
+static int objectId(HeapDump* dump, Obj* object) {
+    if ((dump->count + 1) * 2 > dump->tableCapacity) growTable(dump);
+
+    uint32_t index = hashPointer(object) & (dump->tableCapacity - 1);
+    while (dump->keys[index] != NULL) {
+        if (dump->keys[index] == object) return dump->ids[index];
+        index = (index + 1) & (dump->tableCapacity - 1);
+    }
+
+    if (dump->count + 1 > dump->capacity) {
+        dump->objects = growBuffer(dump->objects, &dump->capacity, sizeof(Obj*));
+    }
+    dump->keys[index] = object;
+    dump->ids[index] = dump->count;
+    dump->objects[dump->count] = object;
+    return dump->count++;
+}
+
+static void addRoot(HeapDump* dump, Obj* object, RootKind kind) {
+    if (object == NULL) return;
+    if (dump->rootCount + 1 > dump->rootCapacity) {
+        dump->roots = growBuffer(dump->roots, &dump->rootCapacity, sizeof(DumpRoot));
+    }
+    dump->roots[dump->rootCount].object = objectId(dump, object);
+    dump->roots[dump->rootCount].kind = kind;
+    dump->rootCount++;
+}
+
+static void addRootValue(HeapDump* dump, Value value, RootKind kind) {
+    if (IS_OBJ(value)) addRoot(dump, OBJ_VALUE_TO_C(value), kind);
+}
+
+//Everything markRoots would mark, apart from the compiler's and the
+//remembered set
+static void addRoots(HeapDump* dump) {
+    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        addRootValue(dump, *slot, ROOT_STACK);
+    }
+    for (int i = 0; i < vm.frameCount; i++) {
+        addRoot(dump, (Obj*)vm.frames[i].function, ROOT_FRAME);
+    }
+    for (int i = 0; i < vm.globalValues.count; i++) {
+        addRootValue(dump, vm.globalValues.values[i], ROOT_GLOBAL);
+    }
+    for (int i = 0; i < vm.globalIdentifiers.count; i++) {
+        addRootValue(dump, vm.globalIdentifiers.values[i], ROOT_VM);
+    }
+    for (int i = 0; i < vm.globalNames.capacity; i++) {
+        addRoot(dump, (Obj*)vm.globalNames.entries[i].key, ROOT_VM);
+    }
+
+    addRoot(dump, (Obj*)vm.initString, ROOT_VM);
+    addRoot(dump, (Obj*)vm.drawString, ROOT_VM);
+    addRoot(dump, (Obj*)vm.strX, ROOT_VM);
+    addRoot(dump, (Obj*)vm.strY, ROOT_VM);
+    addRoot(dump, (Obj*)vm.strR, ROOT_VM);
+    addRoot(dump, (Obj*)vm.strG, ROOT_VM);
+    addRoot(dump, (Obj*)vm.strB, ROOT_VM);
+    addRoot(dump, (Obj*)vm.strA, ROOT_VM);
+    addRoot(dump, (Obj*)vm.gcStatsEntity, ROOT_VM);
+
+    for (Shape* shape = vm.shapes; shape != NULL; shape = shape->next) {
+        if (shape->fieldCount > 0) {
+            addRoot(dump, (Obj*)shape->keys[shape->fieldCount - 1], ROOT_SHAPE);
+        }
+    }
+}
+
+static void addReference(HeapDump* dump, Obj* object) {
+    if (object == NULL) return;
+    if (dump->referenceCount + 1 > dump->referenceCapacity) {
+        dump->references = growBuffer(dump->references, &dump->referenceCapacity,
+                                      sizeof(Obj*));
+    }
+    dump->references[dump->referenceCount++] = object;
+}
+
+static void addReferenceValues(HeapDump* dump, Value* values, int count) {
+    for (int i = 0; i < count; i++) {
+        if (IS_OBJ(values[i])) addReference(dump, OBJ_VALUE_TO_C(values[i]));
+    }
+}
+
+//Fills dump->references the way blackenObject walks the object
+static void findReferences(HeapDump* dump, Obj* object) {
+    dump->referenceCount = 0;
+    switch (object->type) {
+        case OBJ_ENTITY:
+            addReference(dump, (Obj*)((ObjEntity*)object)->name);
+            break;
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            addReference(dump, (Obj*)instance->entity);
+            addReferenceValues(dump, instance->fields, instance->shape->fieldCount);
+            break;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            addReference(dump, (Obj*)function->name);
+            addReferenceValues(dump, function->chunk.constants.values,
+                               function->chunk.constants.count);
+            break;
+        }
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            addReferenceValues(dump, array->elements, array->count);
+            break;
+        }
+        case OBJ_NATIVE:
+        case OBJ_STRING:
+#ifdef NAN_BOXING
+        case OBJ_VECTOR2:
+#endif
+            break;
+    }
+}
+
+//The object and the buffers only it points at
+static size_t dumpSize(Obj* object) {
+    size_t size = sizeOfObject(object);
+    switch (object->type) {
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            if (instance->fields != instance->inlineFields) {
+                size += sizeof(Value) * instance->fieldCapacity;
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            Chunk* chunk = &((ObjFunction*)object)->chunk;
+            size += (sizeof(uint8_t) + sizeof(int)) * chunk->capacity;
+            size += sizeof(Value) * chunk->constants.capacity;
+            size += sizeof(InlineCache) * chunk->cacheCapacity;
+            break;
+        }
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            size += sizeof(Value) * array->capacity + array->cardCount;
+            break;
+        }
+        default:
+            break;
+    }
+    return size;
+}
+
+static const char* dumpLabel(Obj* object) {
+    switch (object->type) {
+        case OBJ_ENTITY:   return ((ObjEntity*)object)->name->chars;
+        case OBJ_INSTANCE: return ((ObjInstance*)object)->entity->name->chars;
+        case OBJ_STRING:   return ((ObjString*)object)->chars;
+        case OBJ_FUNCTION: {
+            ObjString* name = ((ObjFunction*)object)->name;
+            return name == NULL ? "script" : name->chars;
+        }
+        default:           return "";
+    }
+}
+
+static void writeU8(FILE* file, uint8_t value) {
+    fputc(value, file);
+}
+
+static void writeU16(FILE* file, uint16_t value) {
+    writeU8(file, value & 0xff);
+    writeU8(file, value >> 8);
+}
+
+static void writeU32(FILE* file, uint32_t value) {
+    writeU16(file, value & 0xffff);
+    writeU16(file, value >> 16);
+}
+
+static void freeHeapDump(HeapDump* dump) {
+    free(dump->objects);
+    free(dump->keys);
+    free(dump->ids);
+    free(dump->roots);
+    free(dump->references);
+}
+
+//Walks the heap from the roots without collecting or moving anything, so
+//it can be called from a native in the middle of a frame
+bool writeHeapDump(const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return false;
+
+    HeapDump dump;
+    memset(&dump, 0, sizeof(HeapDump));
+    addRoots(&dump);
+    for (int id = 0; id < dump.count; id++) {
+        findReferences(&dump, dump.objects[id]);
+        for (int i = 0; i < dump.referenceCount; i++) {
+            objectId(&dump, dump.references[i]);
+        }
+    }
+
+    fwrite(DUMP_MAGIC, 1, 8, file);
+    writeU32(file, dump.rootCount);
+    for (int i = 0; i < dump.rootCount; i++) {
+        writeU32(file, dump.roots[i].object);
+        writeU8(file, dump.roots[i].kind);
+    }
+
+    writeU32(file, dump.count);
+    for (int id = 0; id < dump.count; id++) {
+        Obj* object = dump.objects[id];
+        writeU8(file, object->type);
+        writeU32(file, (uint32_t)dumpSize(object));
+
+        const char* label = dumpLabel(object);
+        size_t length = strlen(label);
+        if (length > LABEL_MAX) length = LABEL_MAX;
+        writeU16(file, (uint16_t)length);
+        fwrite(label, 1, length, file);
+
+        findReferences(&dump, object);
+        writeU32(file, dump.referenceCount);
+        for (int i = 0; i < dump.referenceCount; i++) {
+            writeU32(file, objectId(&dump, dump.references[i]));
+        }
+    }
+
+    freeHeapDump(&dump);
+    bool written = !ferror(file);
+    return fclose(file) == 0 && written;
+}
+
+//The analyzer only needs the file, it can run on a dump from another build
+typedef struct {
+    int count;
+    uint8_t* types;
+    uint32_t* sizes;
+    char** labels;
+    int* referenceStart;  //References of object i are [start[i], start[i + 1])
+    uint32_t* references;
+    int rootCount;
+    uint32_t* roots;
+} LoadedDump;
+
+static const char* dumpTypeNames[] = {
+    "entity", "instance", "function", "native", "string", "array", "Vector2",
+};
+
+static const char* dumpTypeName(uint8_t type) {
+    if (type < sizeof(dumpTypeNames) / sizeof(dumpTypeNames[0])) return dumpTypeNames[type];
+    return "?";
+}
+
+static bool readU8(FILE* file, uint8_t* value) {
+    int c = fgetc(file);
+    if (c == EOF) return false;
+    *value = (uint8_t)c;
+    return true;
+}
+
+static bool readU16(FILE* file, uint16_t* value) {
+    uint8_t low, high;
+    if (!readU8(file, &low) || !readU8(file, &high)) return false;
+    *value = (uint16_t)(low | (high << 8));
+    return true;
+}
+
+static bool readU32(FILE* file, uint32_t* value) {
+    uint16_t low, high;
+    if (!readU16(file, &low) || !readU16(file, &high)) return false;
+    *value = (uint32_t)low | ((uint32_t)high << 16);
+    return true;
+}
+
+static void freeLoadedDump(LoadedDump* dump) {
+    for (int i = 0; i < dump->count && dump->labels != NULL; i++) free(dump->labels[i]);
+    free(dump->types);
+    free(dump->sizes);
+    free(dump->labels);
+    free(dump->referenceStart);
+    free(dump->references);
+    free(dump->roots);
+}
+
+//Bytes left between the read position and the end of the file
+static long remainingBytes(FILE* file, long fileSize) {
+    long position = ftell(file);
+    return position < 0 ? 0 : fileSize - position;
+}
+
+//Counts come from the file, so each is checked against what the rest of the
+//file could hold before anything is allocated for it
+static bool loadDump(FILE* file, LoadedDump* dump) {
+    if (fseek(file, 0, SEEK_END) != 0) return false;
+    long fileSize = ftell(file);
+    if (fileSize < 0 || fseek(file, 0, SEEK_SET) != 0) return false;
+
+    char magic[8];
+    if (fread(magic, 1, 8, file) != 8 || memcmp(magic, DUMP_MAGIC, 8) != 0) return false;
+
+    //A root is a u32 and a u8, an object at least a u8, u32, u16 and u32
+    uint32_t rootCount;
+    if (!readU32(file, &rootCount)) return false;
+    if (rootCount > INT_MAX || rootCount > remainingBytes(file, fileSize) / 5) return false;
+    dump->roots = (uint32_t*)malloc(sizeof(uint32_t) * ((size_t)rootCount + 1));
+    if (dump->roots == NULL) return false;
+    for (uint32_t i = 0; i < rootCount; i++) {
+        uint8_t kind;
+        if (!readU32(file, &dump->roots[i]) || !readU8(file, &kind)) return false;
+    }
+    dump->rootCount = (int)rootCount;
+
+    //The analyzer adds a root of its own after the last object
+    uint32_t count;
+    if (!readU32(file, &count)) return false;
+    if (count >= INT_MAX || count > remainingBytes(file, fileSize) / 11) return false;
+    dump->types = (uint8_t*)malloc((size_t)count + 1);
+    dump->sizes = (uint32_t*)malloc(sizeof(uint32_t) * ((size_t)count + 1));
+    dump->labels = (char**)calloc((size_t)count + 1, sizeof(char*));
+    dump->referenceStart = (int*)malloc(sizeof(int) * ((size_t)count + 1));
+    if (dump->types == NULL || dump->sizes == NULL || dump->labels == NULL ||
+        dump->referenceStart == NULL) return false;
+    dump->count = (int)count;
+
+    int referenceCapacity = 0;
+    int referenceCount = 0;
+    for (uint32_t id = 0; id < count; id++) {
+        uint16_t length;
+        uint32_t references;
+        if (!readU8(file, &dump->types[id]) || !readU32(file, &dump->sizes[id]) ||
+            !readU16(file, &length)) return false;
+
+        dump->labels[id] = (char*)malloc((size_t)length + 1);
+        if (dump->labels[id] == NULL || fread(dump->labels[id], 1, length, file) != length) {
+            return false;
+        }
+        dump->labels[id][length] = '\0';
+
+        //The analyzer indexes these and the made up root's edges with ints
+        if (!readU32(file, &references)) return false;
+        if (references > remainingBytes(file, fileSize) / 4 ||
+            references > (uint32_t)(INT_MAX / 2 - dump->rootCount - referenceCount)) {
+            return false;
+        }
+        dump->referenceStart[id] = referenceCount;
+        for (uint32_t i = 0; i < references; i++) {
+            if (referenceCount + 1 > referenceCapacity) {
+                dump->references = growBuffer(dump->references, &referenceCapacity,
+                                              sizeof(uint32_t));
+            }
+            if (!readU32(file, &dump->references[referenceCount])) return false;
+            if (dump->references[referenceCount] >= count) return false;
+            referenceCount++;
+        }
+    }
+    dump->referenceStart[count] = referenceCount;
+
+    for (int i = 0; i < dump->rootCount; i++) {
+        if (dump->roots[i] >= count) return false;
+    }
+    return true;
+}
+
+//Successors of node, where node count is a made up root pointing at every
+//real root
+static int successors(LoadedDump* dump, int node, uint32_t** out) {
+    if (node == dump->count) {
+        *out = dump->roots;
+        return dump->rootCount;
+    }
+    *out = &dump->references[dump->referenceStart[node]];
+    return dump->referenceStart[node + 1] - dump->referenceStart[node];
+}
+
+//Lengauer and Tarjan's eval with path compression. Walks the path up by
+//hand, a long next/prev chain is as deep as the heap
+static int evalDominator(int* ancestor, int* label, int* semi, int* path, int node) {
+    if (ancestor[node] == -1) return node;
+
+    int length = 0;
+    for (int up = node; ancestor[ancestor[up]] != -1; up = ancestor[up]) {
+        path[length++] = up;
+    }
+    while (length > 0) {
+        int up = path[--length];
+        int above = ancestor[up];
+        if (semi[label[above]] < semi[label[up]]) label[up] = label[above];
+        ancestor[up] = ancestor[above];
+    }
+    return label[node];
+}
+
+//Lengauer and Tarjan's algorithm with simple linking, near linear in the
+//references. Returns the immediate dominator of every object, the made up
+//root for objects only it reaches, and the nodes in postorder
+static int* findDominators(LoadedDump* dump, int** postorderOut, int** orderOut) {
+    int nodes = dump->count + 1;
+    int root = dump->count;
+    int* postorder = (int*)malloc(sizeof(int) * nodes);
+    int* order = (int*)malloc(sizeof(int) * nodes);    //Nodes by postorder
+    int* preorder = (int*)malloc(sizeof(int) * nodes);
+    int* vertex = (int*)malloc(sizeof(int) * nodes);   //Nodes by preorder
+    int* parent = (int*)malloc(sizeof(int) * nodes);
+    int* next = (int*)malloc(sizeof(int) * nodes);     //Next successor to visit
+    int* stack = (int*)malloc(sizeof(int) * nodes);
+    int* dominators = (int*)malloc(sizeof(int) * nodes);
+    if (postorder == NULL || order == NULL || preorder == NULL || vertex == NULL ||
+        parent == NULL || next == NULL || stack == NULL || dominators == NULL) exit(1);
+
+    for (int i = 0; i < nodes; i++) {
+        postorder[i] = -1;
+        preorder[i] = -1;
+        next[i] = -1;
+        dominators[i] = -1;
+    }
+
+    int reached = 0;
+    int visited = 0;
+    int depth = 0;
+    stack[depth++] = root;
+    next[root] = 0;
+    preorder[root] = reached;
+    vertex[reached++] = root;
+    parent[root] = -1;
+    while (depth > 0) {
+        int node = stack[depth - 1];
+        uint32_t* edges;
+        int edgeCount = successors(dump, node, &edges);
+        if (next[node] < edgeCount) {
+            int successor = (int)edges[next[node]++];
+            if (next[successor] == -1) {
+                next[successor] = 0;
+                preorder[successor] = reached;
+                vertex[reached++] = successor;
+                parent[successor] = node;
+                stack[depth++] = successor;
+            }
+            continue;
+        }
+        postorder[node] = visited;
+        order[visited++] = node;
+        depth--;
+    }
+
+    //Predecessors, only between nodes the walk reached
+    int* predecessorStart = (int*)calloc(nodes + 1, sizeof(int));
+    if (predecessorStart == NULL) exit(1);
+    for (int node = 0; node < nodes; node++) {
+        if (preorder[node] == -1) continue;
+        uint32_t* edges;
+        int edgeCount = successors(dump, node, &edges);
+        for (int i = 0; i < edgeCount; i++) predecessorStart[edges[i] + 1]++;
+    }
+    for (int node = 0; node < nodes; node++) {
+        predecessorStart[node + 1] += predecessorStart[node];
+    }
+    int* predecessors = (int*)malloc(sizeof(int) * (predecessorStart[nodes] + 1));
+    int* fill = (int*)malloc(sizeof(int) * nodes);
+    if (predecessors == NULL || fill == NULL) exit(1);
+    memcpy(fill, predecessorStart, sizeof(int) * nodes);
+    for (int node = 0; node < nodes; node++) {
+        if (preorder[node] == -1) continue;
+        uint32_t* edges;
+        int edgeCount = successors(dump, node, &edges);
+        for (int i = 0; i < edgeCount; i++) predecessors[fill[edges[i]]++] = node;
+    }
+
+    //Semidominators are kept as preorder numbers. The DFS arrays are done
+    //with, so they are reused for the forest and the buckets
+    int* semi = preorder;
+    int* ancestor = next;
+    int* label = stack;
+    int* bucket = fill;   //First node waiting on each node, -1 for none
+    int* bucketNext = (int*)malloc(sizeof(int) * nodes);
+    int* path = (int*)malloc(sizeof(int) * nodes);
+    if (bucketNext == NULL || path == NULL) exit(1);
+    for (int node = 0; node < nodes; node++) {
+        ancestor[node] = -1;
+        label[node] = node;
+        bucket[node] = -1;
+    }
+
+    for (int i = reached - 1; i > 0; i--) {
+        int node = vertex[i];
+        for (int p = predecessorStart[node]; p < predecessorStart[node + 1]; p++) {
+            int lowest = evalDominator(ancestor, label, semi, path, predecessors[p]);
+            if (semi[lowest] < semi[node]) semi[node] = semi[lowest];
+        }
+        int semidominator = vertex[semi[node]];
+        bucketNext[node] = bucket[semidominator];
+        bucket[semidominator] = node;
+        ancestor[node] = parent[node];
+
+        for (int waiting = bucket[parent[node]]; waiting != -1; waiting = bucketNext[waiting]) {
+            int lowest = evalDominator(ancestor, label, semi, path, waiting);
+            dominators[waiting] = semi[lowest] < semi[waiting] ? lowest : parent[node];
+        }
+        bucket[parent[node]] = -1;
+    }
+    for (int i = 1; i < reached; i++) {
+        int node = vertex[i];
+        if (dominators[node] != vertex[semi[node]]) {
+            dominators[node] = dominators[dominators[node]];
+        }
+    }
+    dominators[root] = root;
+
+    free(preorder);
+    free(vertex);
+    free(parent);
+    free(next);
+    free(stack);
+    free(predecessorStart);
+    free(predecessors);
+    free(fill);
+    free(bucketNext);
+    free(path);
+    *postorderOut = postorder;
+    *orderOut = order;
+    return dominators;
+}
+
+typedef struct {
+    uint8_t type;
+    const char* label;  //Entity name for instances, NULL otherwise
+    size_t count;
+    size_t bytes;
+} TypeTotal;
+
+static int compareTotals(const void* a, const void* b) {
+    const TypeTotal* left = (const TypeTotal*)a;
+    const TypeTotal* right = (const TypeTotal*)b;
+    if (left->bytes != right->bytes) return left->bytes < right->bytes ? 1 : -1;
+    return 0;
+}
+
+static size_t* sortRetained;
+
+static int compareRetained(const void* a, const void* b) {
+    size_t left = sortRetained[*(const int*)a];
+    size_t right = sortRetained[*(const int*)b];
+    if (left != right) return left < right ? 1 : -1;
+    return 0;
+}
+
+static void printObjectName(LoadedDump* dump, int id) {
+    if (id == dump->count) {
+        printf("<roots>");
+        return;
+    }
+    printf("#%d %s", id, dumpTypeName(dump->types[id]));
+    if (dump->labels[id][0] != '\0') printf(" %s", dump->labels[id]);
+}
+
+//Instances are totalled per entity, the rest per type
+static void printTypeTotals(LoadedDump* dump) {
+    TypeTotal* totals = NULL;
+    int totalCount = 0;
+    int totalCapacity = 0;
+    for (int id = 0; id < dump->count; id++) {
+        const char* label = dump->types[id] == OBJ_INSTANCE ? dump->labels[id] : NULL;
+        int index = 0;
+        while (index < totalCount &&
+               (totals[index].type != dump->types[id] ||
+                (label != NULL && strcmp(totals[index].label, label) != 0))) index++;
+        if (index == totalCount) {
+            if (totalCount + 1 > totalCapacity) {
+                totals = growBuffer(totals, &totalCapacity, sizeof(TypeTotal));
+            }
+            totals[index].type = dump->types[id];
+            totals[index].label = label;
+            totals[index].count = 0;
+            totals[index].bytes = 0;
+            totalCount++;
+        }
+        totals[index].count++;
+        totals[index].bytes += dump->sizes[id];
+    }
+    if (totalCount > 0) qsort(totals, totalCount, sizeof(TypeTotal), compareTotals);
+
+    printf("heap: %12s %10s  %s\n", "bytes", "count", "type");
+    for (int i = 0; i < totalCount; i++) {
+        printf("heap: %12zu %10zu  %s%s%s\n", totals[i].bytes, totals[i].count,
+                dumpTypeName(totals[i].type), totals[i].label != NULL ? " " : "",
+                totals[i].label != NULL ? totals[i].label : "");
+    }
+    free(totals);
+}
+
+//How many of the biggest retainers are listed
+#define DUMP_TOP_RETAINERS 20
+
+bool analyzeHeapDump(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return false;
+
+    LoadedDump dump;
+    memset(&dump, 0, sizeof(LoadedDump));
+    bool loaded = loadDump(file, &dump);
+    fclose(file);
+    if (!loaded) {
+        freeLoadedDump(&dump);
+        return false;
+    }
+
+    size_t total = 0;
+    for (int id = 0; id < dump.count; id++) total += dump.sizes[id];
+    printf("heap: %d objects, %zu bytes, %d roots\n", dump.count, total, dump.rootCount);
+    printTypeTotals(&dump);
+
+    //Anything an object dominates is freed with it, so its retained size
+    //is its own plus everything below it in the dominator tree. A node's
+    //dominator always comes later in postorder
+    int* postorder;
+    int* order;
+    int* dominators = findDominators(&dump, &postorder, &order);
+    size_t* retained = (size_t*)calloc(dump.count + 1, sizeof(size_t));
+    int* ranked = (int*)malloc(sizeof(int) * (dump.count + 1));
+    if (retained == NULL || ranked == NULL) exit(1);
+    int reached = 0;
+    for (int i = 0; i < dump.count + 1 && order[i] != dump.count; i++) {
+        int node = order[i];
+        retained[node] += dump.sizes[node];
+        retained[dominators[node]] += retained[node];
+        ranked[reached++] = node;
+    }
+
+    sortRetained = retained;
+    qsort(ranked, reached, sizeof(int), compareRetained);
+    printf("heap: %12s %10s  %s\n", "retained", "bytes", "object (dominator)");
+    for (int i = 0; i < reached && i < DUMP_TOP_RETAINERS; i++) {
+        int id = ranked[i];
+        printf("heap: %12zu %10u  ", retained[id], dump.sizes[id]);
+        printObjectName(&dump, id);
+        printf(" (");
+        printObjectName(&dump, dominators[id]);
+        printf(")\n");
+    }
+
+    free(retained);
+    free(ranked);
+    free(dominators);
+    free(postorder);
+    free(order);
+    freeLoadedDump(&dump);
+    return true;
+}
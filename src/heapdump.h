@@ -0,0 +1,25 @@
+#ifndef graphiC_heapdump_h
+#define graphiC_heapdump_h
+
+#include "common.h"
+
+//A dump is the object graph reachable from the roots, written as
+//  "GCDUMP01", u32 root count, then per root: u32 object, u8 RootKind
+//  u32 object count, then per object in id order:
+//    u8 ObjType, u32 bytes, u16 label length, label,
+//    u32 reference count, u32 object per reference
+//Integers are little endian. Bytes include the buffers the object owns
+typedef enum {
+    ROOT_STACK,
+    ROOT_FRAME,
+    ROOT_GLOBAL,
+    ROOT_VM,     //Strings and objects the VM keeps for itself
+    ROOT_SHAPE,  //Field names held by shapes
+    ROOT_KIND_COUNT
+} RootKind;
+
+bool writeHeapDump(const char* path);
+//Prints the types taking the most memory and the objects retaining it
+bool analyzeHeapDump(const char* path);
+
+#endif
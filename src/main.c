@@ -8,6 +8,8 @@
 #include "value.h"
 #include "memory.h"
 #include "vm.h"
+#include "heapdump.h"
+#include "bench.h"
 
 static void repl(){
     char line[1024];
@@ -54,31 +56,104 @@ static char* readFile(const char* path){
     return buffer;
 }
 
-static void runFile(const char* path){
+//The exit code waits until the GC log and heap dump are written, a script
+//that failed is when they are wanted most
+static InterpretResult runFile(const char* path){
     char* source = readFile(path);
     InterpretResult result = interpret(source);
     free(source);
+    return result;
+}
 
-    if(result == INTERPRET_COMPILE_ERROR) exit(65);
-    if(result == INTERPRET_RUNTIME_ERROR) exit (70);
+static void usage(){
+    fprintf(stderr, "Usage: clox [--mark-threads n] [--frames n] [--gc-log file] [--heap-dump file] [path]\n"
+                    "       clox --analyze dump\n"
+                    "       clox [--mark-threads n] --bench results [--bench-baseline results] [--bench-scale n]\n");
+    exit(64);
 }
 
 int main(int argc, const char* argv[]){
     initVM();
-    
-    if (argc == 1){
-        repl();
+
+    const char* path = NULL;
+    const char* gcLogPath = NULL;
+    const char* heapDumpPath = NULL;
+    const char* benchPath = NULL;
+    const char* benchBaseline = NULL;
+    int benchScale = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mark-threads") == 0) {
+            if (i + 1 == argc) usage();
+            vm.markThreads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--frames") == 0) {
+            if (i + 1 == argc) usage();
+            vm.frameLimit = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--bench") == 0) {
+            if (i + 1 == argc) usage();
+            benchPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bench-baseline") == 0) {
+            if (i + 1 == argc) usage();
+            benchBaseline = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bench-scale") == 0) {
+            if (i + 1 == argc) usage();
+            benchScale = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--gc-log") == 0) {
+            if (i + 1 == argc) usage();
+            gcLogPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--heap-dump") == 0) {
+            if (i + 1 == argc) usage();
+            heapDumpPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--analyze") == 0) {
+            if (i + 2 != argc) usage();
+            if (!analyzeHeapDump(argv[++i])) {
+                fprintf(stderr, "Could not read heap dump \"%s\".\n", argv[i]);
+                exit(74);
+            }
+            freeVM();
+            return 0;
+        }
+        else if (path == NULL) {
+            path = argv[i];
+        }
+        else {
+            usage();
+        }
+    }
+
+    if (benchPath != NULL) {
+        if (path != NULL) usage();
+        bool passed = runBenchmarks(benchPath, benchBaseline, benchScale);
+        freeVM();
+        return passed ? 0 : 1;
     }
-    else if (argc == 2){
-        runFile(argv[1]);
+
+    InterpretResult result = INTERPRET_OK;
+    if (path == NULL){
+        repl();
     }
     else {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+        result = runFile(path);
+    }
+
+    //What the globals still hold once the script is done
+    if (heapDumpPath != NULL && !writeHeapDump(heapDumpPath)) {
+        fprintf(stderr, "Could not write \"%s\".\n", heapDumpPath);
+    }
+    //JSON, or CSV when the name ends in .csv
+    if (gcLogPath != NULL && !writeGCLog(gcLogPath)) {
+        fprintf(stderr, "Could not write \"%s\".\n", gcLogPath);
     }
-    
 
     freeVM();
     // freeChunk(&chunk);
+    if(result == INTERPRET_COMPILE_ERROR) return 65;
+    if(result == INTERPRET_RUNTIME_ERROR) return 70;
     return 0;
 }
\ No newline at end of file
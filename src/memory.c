@@ -1,55 +1,53 @@
 #include <stdlib.h>
+#include <string.h>
 #include "memory.h"
 #include "vm.h"
 #include "compiler.h"
 #include "object.h"
+#include "slab.h"
 
 #define GC_HEAP_GROW_FACTOR 2
 
+#ifdef PARALLEL_MARK
+#include <sched.h>
+#endif
+
 #ifdef DEBUG_LOG_GC
 #include <stdio.h>
 #include "debug.h"
 #endif
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
-    
-    if (vm.freeingTenured){
-        vm.bytesAllocatedTenure += newSize - oldSize;
-    }
-    else {
-        vm.bytesAllocated += newSize - oldSize;
-    }
-
+static size_t sweepPages(size_t count);
 
-    if (newSize > oldSize && !vm.isGCing) {
-        #ifdef DEBUG_STRESS_GC
-        collectGarbage(true);
-        #endif
+//Everything malloc'd or cut from a slab counts towards the old generation.
+//The nursery is accounted for separately in allocateYoung
+static void countTenure(size_t oldSize, size_t newSize) {
+    vm.bytesAllocatedTenure += newSize - oldSize;
+    if (newSize > oldSize && (vm.marking || vm.sweeping)) {
+        vm.tenureUnjudged += newSize - oldSize;
+    }
 
-        #ifdef DEBUG_LOG_TIME
-        struct timespec start, end;
-        clock_gettime(CLOCK_MONOTONIC, &start);
-        #endif
+    //Whatever the last major left unswept is paid off by the allocations
+    //that come after it, a batch at a time
+    if (newSize > oldSize && vm.sweeping && !vm.isGCing) {
+        sweepPages(GC_SWEEP_PAGES);
+    }
 
-        if(vm.bytesAllocatedTenure > vm.nextGCTenure){
-            vm.isMajor = true;
-            collectGarbage(true);
-        }
-        else if (vm.bytesAllocated > vm.nextGC) {
-            //TODO: REMEMBER THAT THIS IS TRUE FOR DEBUGS
-            vm.isMajor = false;
-            collectGarbage(false);
-        }
-        #ifdef DEBUG_LOG_TIME
-        clock_gettime(CLOCK_MONOTONIC, &end);
-        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
-        if (vm.isMajor) {
-            vm.totalMajorTime += elapsed;
-        } else {
-            vm.totalMinorTime += elapsed;
-        }
-        #endif
+    //Nothing is collected here, the caller may be holding pointers the GC
+    //can't see. The collection waits for the next safepoint in run().
+    //While marking is in progress only a heap that kept growing regardless
+    //asks for it to be finished early
+    size_t limit = vm.marking ? vm.nextGCTenure * GC_HEAP_GROW_FACTOR : vm.nextGCTenure;
+    //Until the sweep is done the count still includes the dead
+    if (newSize > oldSize && !vm.isGCing && !vm.sweeping &&
+        vm.bytesAllocatedTenure > limit) {
+        vm.gcRequested = true;
+        vm.majorRequested = true;
     }
+}
+
+void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+    countTenure(oldSize, newSize);
 
     if (newSize == 0) {
         free(pointer);
@@ -62,86 +60,231 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
     return result;
 }
 
-static void freeObject(Obj* object){
-    #ifdef DEBUG_LOG_GC
-        printf("%p free type %d\n", (void*)object, object->type);
+#define ALIGN_OBJECT(size) (((size) + 7) & ~(size_t)7)
+
+//Old objects live in slab pages, where their mark bits are
+static Obj* allocateOld(size_t size) {
+    countTenure(0, size);
+    Obj* object = (Obj*)slabAllocate(size);
+    //The page may not have been swept yet, and an unmarked cell there is
+    //taken for dead
+    if (vm.sweeping) slabSetMark(object);
+    return object;
+}
+
+//A young object that has been copied keeps the address of the copy right
+//after its header, where its own fields used to be
+#define FORWARDED(object) (*(Obj**)((Obj*)(object) + 1))
+
+#ifdef FRAME_ARENA
+//Objects outside the arena can only be given a pointer into it through a
+//store, which lands here. A loop storing into the same object is only
+//listed once
+static void recordFrameEscape(Obj* source) {
+    if (vm.frameEscapeCount > 0 &&
+        vm.frameEscapes[vm.frameEscapeCount - 1] == source) return;
+
+    if (vm.frameEscapeCapacity < vm.frameEscapeCount + 1) {
+        vm.frameEscapeCapacity = GROW_CAPACITY(vm.frameEscapeCapacity);
+        vm.frameEscapes = (Obj**)realloc(vm.frameEscapes,
+                                    sizeof(Obj*) * vm.frameEscapeCapacity);
+        if (vm.frameEscapes == NULL) exit(1);
+    }
+    vm.frameEscapes[vm.frameEscapeCount++] = source;
+}
+
+//A full arena spills into the nursery, whose objects are filled in without
+//a barrier. A minor is asked for, it moves the arena's survivors out too
+static Obj* allocateFrame(size_t size) {
+    if ((size_t)(vm.frameArenaEnd - vm.frameArenaTop) < size) {
+        vm.frameOverflowed = true;
+        vm.gcRequested = true;
+        vm.minorRequested = true;
+        return NULL;
+    }
+
+    Obj* object = (Obj*)vm.frameArenaTop;
+    vm.frameArenaTop += size;
+    return object;
+}
+#endif
+
+//Bump allocates from the nursery, or the frame arena during draw(). Returns
+//NULL when the object doesn't fit, the caller then allocates it tenured and
+//a minor GC is asked for
+Obj* allocateYoung(size_t size) {
+    size = ALIGN_OBJECT(size);
+    //Big objects would empty the nursery on their own
+    if (size > NURSERY_SIZE / 4) return NULL;
+
+    Obj* object = NULL;
+    #ifdef FRAME_ARENA
+    if (vm.frameArenaActive) object = allocateFrame(size);
     #endif
-    switch (object->type){
-        case OBJ_ENTITY: {
-            vm.freeingTenured = object->isTenured;
-            FREE(ObjEntity, object);
-            vm.freeingTenured = false;
-            break;
+
+    if (object == NULL) {
+        if ((size_t)(vm.nurseryEnd - vm.nurseryTop) < size) {
+            vm.gcRequested = true;
+            vm.minorRequested = true;
+            return NULL;
         }
+
+        object = (Obj*)vm.nurseryTop;
+        vm.nurseryTop += size;
+        vm.bytesAllocated += size;
+    }
+
+    object->isForwarded = false;
+    object->isTenured = false;
+    object->isQueued = false;
+    object->age = 0;
+
+    #ifdef DEBUG_STRESS_GC
+    vm.gcRequested = true;
+    vm.minorRequested = true;
+    #endif
+    return object;
+}
+
+//Gray old objects waiting for a major mark. Kept apart from the gray stack
+//because minor collections run while an incremental mark is unfinished
+static void pushMark(Obj* object) {
+    if (vm.markCapacity < vm.markCount + 1) {
+        vm.markCapacity = GROW_CAPACITY(vm.markCapacity);
+        vm.markStack = (Obj**)realloc(vm.markStack,
+                                    sizeof(Obj*) * vm.markCapacity);
+        if (vm.markStack == NULL) exit(1);
+    }
+    vm.markStack[vm.markCount++] = object;
+}
+
+Obj* allocateTenured(size_t size) {
+    Obj* object = allocateOld(size);
+    object->isForwarded = false;
+    object->isTenured = true;
+    object->isQueued = false;
+
+    //It never went through the nursery, so whatever young objects it gets
+    //pointed at before the next collection have to be found from here
+    appendRememberedSet(&vm.remSet, object);
+    #ifdef FRAME_ARENA
+    if (vm.frameArenaActive) recordFrameEscape(object);
+    #endif
+
+    //Allocated black while marking, or the sweep would free it
+    if (vm.marking) {
+        slabSetMark(object);
+        #ifndef CONCURRENT_MARK
+        pushMark(object);
+        #endif
+    }
+    return object;
+}
+
+//Young objects die without being looked at, so the ones that own a malloc'd
+//buffer are listed here to get it freed
+void trackYoungBuffer(Obj* object) {
+    if (vm.youngBufferCapacity < vm.youngBufferCount + 1) {
+        vm.youngBufferCapacity = GROW_CAPACITY(vm.youngBufferCapacity);
+        vm.youngBuffers = (Obj**)realloc(vm.youngBuffers,
+                                    sizeof(Obj*) * vm.youngBufferCapacity);
+        if (vm.youngBuffers == NULL) exit(1);
+    }
+    vm.youngBuffers[vm.youngBufferCount++] = object;
+}
+
+static void freeObjectBuffers(Obj* object){
+    switch (object->type){
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
-            freeTable(&instance->fields);
-            vm.freeingTenured = object->isTenured;
-            FREE(ObjInstance, object);
-            vm.freeingTenured = false;
+            if (instance->fields != instance->inlineFields) {
+                FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+            }
             break;
         }
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
             freeChunk(&function->chunk);
-
-            vm.freeingTenured = object->isTenured;
-            FREE(ObjFunction, object);
-            vm.freeingTenured = false;
-            break;
-        }
-        case OBJ_NATIVE: {
-            vm.freeingTenured = object->isTenured;
-            FREE(ObjNative, object);
-            vm.freeingTenured = false;
-            break;
-        }
-        case OBJ_STRING: {
-            ObjString* string = (ObjString*)object;
-            FREE_ARRAY(char, string->chars, string->length + 1);
-
-            vm.freeingTenured = object->isTenured;
-            FREE(ObjString, object);
-            vm.freeingTenured = false;
             break;
         }
         case OBJ_ARRAY: {
             ObjArray* array = (ObjArray*)object;
             FREE_ARRAY(Value, array->elements, array->capacity);
-            FREE(ObjArray, object);
+            FREE_ARRAY(uint8_t, array->cards, array->cardCount);
             break;
         }
+        default:
+            break;
     }
 }
 
-void freeObjects() {
-    Obj* object = vm.objects;
-    while (object != NULL) {
-        Obj* next = object->next;
-        vm.freeingTenured = object->isTenured;
-        freeObject(object);
-        vm.freeingTenured = false;
-        object = next;
+//Frees the buffers of young objects that died and follows the survivors,
+//old ones no longer need listing
+static void sweepYoungBuffers() {
+    int count = 0;
+    for (int i = 0; i < vm.youngBufferCount; i++) {
+        Obj* moved = forwardingAddress(vm.youngBuffers[i]);
+        if (moved == NULL) {
+            freeObjectBuffers(vm.youngBuffers[i]);
+        }
+        else if (!moved->isTenured) {
+            vm.youngBuffers[count++] = moved;
+        }
     }
+    vm.youngBufferCount = count;
+}
 
-    free(vm.grayStack);
+//Only ever called on tenured objects, the nursery is freed as a whole. The
+//sweep puts the cell back on its page's free list afterwards
+static void freeObject(void* cell){
+    Obj* object = (Obj*)cell;
+    #ifdef DEBUG_LOG_GC
+        printf("%p free type %d\n", (void*)object, object->type);
+    #endif
+    countTenure(sizeOfObject(object), 0);
+    freeObjectBuffers(object);
 }
 
+#ifdef CONCURRENT_MARK
+static void joinMarker();
+#endif
+#ifdef PARALLEL_MARK
+static void traceMarksParallel();
+#endif
 
+void freeObjects() {
+    #ifdef CONCURRENT_MARK
+    joinMarker();
+    free(vm.snapshotQueue);
+    free(vm.retired);
+    #endif
 
-void markObject(Obj* object, bool isMajor) {
-    if (object == NULL) return;
-    if (object->isMarked) return;
-    if (object->isTenured && !isMajor) return;
-    #ifdef DEBUG_LOG_GC
-    printf("%p mark ", (void*)object);
-    printValue(C_TO_OBJ_VALUE(object));
-    printf("\n");
+    for (int i = 0; i < vm.youngBufferCount; i++) {
+        freeObjectBuffers(vm.youngBuffers[i]);
+    }
+    free(vm.youngBuffers);
+    free(vm.nursery);
+    #ifdef FRAME_ARENA
+    free(vm.frameArena);
+    free(vm.frameEscapes);
     #endif
+    free(vm.survivorFrom);
+    free(vm.survivorTo);
+
+    //With no marks left everything old is swept as dead
+    slabClearMarks();
+    for (int i = 0; i < vm.slabPageCount;) {
+        if (!slabSweep(vm.slabPages[i], freeObject)) i++;
+    }
+    vm.sweeping = false;
+    freeSlabs();
 
-    
+    FREE_ARRAY(Obj*, vm.remSet.objects, vm.remSet.capacity);
+    free(vm.grayStack);
+    free(vm.markStack);
+}
 
-    object->isMarked = true;
+static void pushGray(Obj* object) {
     if (vm.grayCapacity < vm.grayCount + 1) {
         vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
         vm.grayStack = (Obj**)realloc(vm.grayStack,
@@ -152,59 +295,222 @@ void markObject(Obj* object, bool isMajor) {
     vm.grayStack[vm.grayCount++] = object;
 }
 
+//Set when the object being blackened still points at something young
+static bool hasYoungField;
+
+static Obj* copyToSurvivor(Obj* object, size_t size) {
+    size_t aligned = ALIGN_OBJECT(size);
+    if (object->age + 1 >= GC_TENURE_AGE || vm.promoteAll ||
+        (size_t)(vm.survivorEnd - vm.survivorTop) < aligned) {
+        return NULL;
+    }
+
+    Obj* copy = (Obj*)vm.survivorTop;
+    vm.survivorTop += aligned;
+    memcpy(copy, object, size);
+    copy->age++;
+    return copy;
+}
+
+static Obj* copyToTenure(Obj* object, size_t size) {
+    Obj* copy = allocateOld(size);
+    memcpy(copy, object, size);
+    copy->isTenured = true;
+    copy->isQueued = false;
+    vm.gcLog.promoted += size;
+
+    //Promoted during a mark, so it is black like anything allocated old.
+    //A snapshot mark never needs to scan objects newer than the snapshot
+    if (vm.marking) {
+        slabSetMark(copy);
+        #ifndef CONCURRENT_MARK
+        pushMark(copy);
+        #endif
+    }
+    return copy;
+}
+
+//Copies a young object into the other survivor space, or into the old
+//generation once it is old enough, and leaves a forwarding pointer behind.
+//The copy goes on the gray stack to have its fields copied
+static Obj* evacuate(Obj* object) {
+    if (object->isForwarded) return FORWARDED(object);
+
+    #ifdef PROFILE_ALLOCATIONS
+    if (object->age == 0) profileSurvivor(object);
+    #endif
+
+    size_t size = sizeOfObject(object);
+    Obj* copy = copyToSurvivor(object, size);
+    if (copy == NULL) copy = copyToTenure(object, size);
+
+    if (copy->type == OBJ_INSTANCE) {
+        ObjInstance* instance = (ObjInstance*)copy;
+        if (((ObjInstance*)object)->fields == ((ObjInstance*)object)->inlineFields) {
+            instance->fields = instance->inlineFields;
+        }
+    }
+
+    #ifdef DEBUG_LOG_GC
+    printf("%p promote to %p ", (void*)object, (void*)copy);
+    printValue(C_TO_OBJ_VALUE(copy));
+    printf("\n");
+    #endif
+
+    object->isForwarded = true;
+    FORWARDED(object) = copy;
+    pushGray(copy);
+    return copy;
+}
+
+//Where a young object lives after this collection, NULL if it died
+Obj* forwardingAddress(Obj* object) {
+    #ifdef FRAME_ARENA
+    //Dropping the frame arena leaves every other young object in place
+    if (vm.evacuatingFrame && !isFrameObject(object)) return object;
+    #endif
+    return object->isForwarded ? FORWARDED(object) : NULL;
+}
+
+Obj* markObject(Obj* object, bool isMajor) {
+    if (object == NULL) return NULL;
+    //Major marks leave young objects alone, they are all promoted before
+    //the sweep and their fields marked then
+    if (!object->isTenured && isMajor) return object;
+    if (!object->isTenured) {
+        #ifdef NAN_BOXING
+        if (isScratchObject(object)) return object;
+        #endif
+        #ifdef FRAME_ARENA
+        if (vm.evacuatingFrame && !isFrameObject(object)) {
+            hasYoungField = true;
+            return object;
+        }
+        #endif
+        object = evacuate(object);
+        if (!object->isTenured) hasYoungField = true;
+        return object;
+    }
+    if (!isMajor || !slabSetMark(object)) return object;
+    #ifdef DEBUG_LOG_GC
+    printf("%p mark ", (void*)object);
+    printValue(C_TO_OBJ_VALUE(object));
+    printf("\n");
+    #endif
+
+    pushMark(object);
+    return object;
+}
+
 void markNatives(bool isMajor){
-    markObject((Obj*)vm.drawString, isMajor);
-    markObject((Obj*)vm.strVector2, isMajor);
-    markObject((Obj*)vm.strX, isMajor);
-    markObject((Obj*)vm.strY, isMajor);
-    markObject((Obj*)vm.vector2Entity, isMajor);
+    MARK_OBJECT(vm.drawString, isMajor);
+    MARK_OBJECT(vm.strX, isMajor);
+    MARK_OBJECT(vm.strY, isMajor);
 
-    markObject((Obj*)vm.strColor, isMajor);
-    markObject((Obj*)vm.strR, isMajor);
-    markObject((Obj*)vm.strG, isMajor);
-    markObject((Obj*)vm.strB, isMajor);
-    markObject((Obj*)vm.strA, isMajor);
-    markObject((Obj*)vm.colorEntity, isMajor);
+    MARK_OBJECT(vm.strR, isMajor);
+    MARK_OBJECT(vm.strG, isMajor);
+    MARK_OBJECT(vm.strB, isMajor);
+    MARK_OBJECT(vm.strA, isMajor);
 
+    MARK_OBJECT(vm.gcStatsEntity, isMajor);
 }
 
-void markValue(Value value, bool isMajor) {
-    if (IS_OBJ(value)) markObject(OBJ_VALUE_TO_C(value), isMajor);
+Value markValue(Value value, bool isMajor) {
+    if (IS_OBJ(value)) return C_TO_OBJ_VALUE(markObject(OBJ_VALUE_TO_C(value), isMajor));
+    return value;
 }
 
 
 static void markArray(ValueArray* array, bool isMajor) {
     for (int i = 0; i < array->count; i++) {
-        markValue(array->values[i], isMajor);
+        STORE_SHARED(array->values[i], markValue(array->values[i], isMajor));
     }
 }
 
 static void blackenObject(Obj* object, bool isMajor);
 
+//Makes sure every card of a tenured array exists, new cards start clean
+static void ensureCards(ObjArray* array) {
+    int cardCount = (array->capacity + ARRAY_CARD_SIZE - 1) / ARRAY_CARD_SIZE;
+    if (array->cardCount >= cardCount) return;
+
+    array->cards = GROW_ARRAY(uint8_t, array->cards, array->cardCount, cardCount);
+    memset(array->cards + array->cardCount, 0, cardCount - array->cardCount);
+    array->cardCount = cardCount;
+}
+
+//A minor only has to look at the cards the write barrier dirtied. Arrays
+//without cards were promoted or allocated old since the last minor and are
+//scanned whole. Cards are left dirty only while they still hold something young
+static void blackenArrayCards(ObjArray* array) {
+    bool scanAll = array->cards == NULL;
+    bool anyYoung = false;
+
+    for (int start = 0; start < array->count; start += ARRAY_CARD_SIZE) {
+        int card = start / ARRAY_CARD_SIZE;
+        bool hasCard = card < array->cardCount;
+        if (!scanAll && hasCard && !array->cards[card]) continue;
+
+        hasYoungField = false;
+        int end = start + ARRAY_CARD_SIZE < array->count ?
+                    start + ARRAY_CARD_SIZE : array->count;
+        for (int i = start; i < end; i++) {
+            STORE_SHARED(array->elements[i], markValue(array->elements[i], false));
+        }
+
+        if (hasYoungField) {
+            if (!hasCard) ensureCards(array);
+            array->cards[card] = 1;
+            anyYoung = true;
+        }
+        else if (hasCard) {
+            array->cards[card] = 0;
+        }
+    }
+    hasYoungField = anyYoung;
+}
+
 static void markRoots(bool isMajor) {
     markNatives(isMajor);
 
     for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-        markValue(*slot, isMajor);
+        *slot = markValue(*slot, isMajor);
     }
 
     for (int i = 0; i < vm.frameCount; i++) {
-        markObject((Obj*)vm.frames[i].function, isMajor);
+        MARK_OBJECT(vm.frames[i].function, isMajor);
     }
 
     if(!isMajor){
-        for (int i = 0; i < vm.remSet.count; i++) {
-            blackenObject((Obj*)vm.remSet.objects[i], isMajor);
+        //Entries that still point at a survivor put themselves back
+        RememberedSet remembered = vm.remSet;
+        vm.remSet.objects = NULL;
+        vm.remSet.count = 0;
+        vm.remSet.capacity = 0;
+
+        for (int i = 0; i < remembered.count; i++) {
+            remembered.objects[i]->isQueued = false;
         }
+        for (int i = 0; i < remembered.count; i++) {
+            blackenObject(remembered.objects[i], isMajor);
+        }
+        FREE_ARRAY(Obj*, remembered.objects, remembered.capacity);
     }
 
-    markTable(&vm.globals, isMajor);
+    markShapes(isMajor);
+    markTable(&vm.globalNames, isMajor);
+    markArray(&vm.globalValues, isMajor);
+    markArray(&vm.globalIdentifiers, isMajor);
     markCompilerRoots(isMajor);
-    markObject((Obj*)vm.initString, isMajor);
+    MARK_OBJECT(vm.initString, isMajor);
+    #ifdef PROFILE_ALLOCATIONS
+    markAllocationProfile(isMajor);
+    #endif
 
 }
 
 static void blackenObject(Obj* object, bool isMajor) {
+    hasYoungField = false;
     #ifdef DEBUG_LOG_GC
         printf("%p blacken ", (void*)object);
         printValue(C_TO_OBJ_VALUE(object));
@@ -213,90 +519,155 @@ static void blackenObject(Obj* object, bool isMajor) {
     switch (object->type) {
         case OBJ_ENTITY: {
             ObjEntity* entity = (ObjEntity*)object;
-            markObject((Obj*)entity->name, isMajor);
+            MARK_OBJECT(entity->name, isMajor);
             break;
         }
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
+            //Entities are allocated old and never move
             markObject((Obj*)instance->entity, isMajor);
-            markTable(&instance->fields, isMajor);
+            for (int i = 0; i < instance->shape->fieldCount; i++) {
+                STORE_SHARED(instance->fields[i], markValue(instance->fields[i], isMajor));
+            }
             break;
         }
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
-            markObject((Obj*)function->name, isMajor);
+            MARK_OBJECT(function->name, isMajor);
             markArray(&function->chunk.constants, isMajor);
             break;
         }
         case OBJ_ARRAY: {
             ObjArray* array = (ObjArray*)object;
+            if (!isMajor && object->isTenured) {
+                blackenArrayCards(array);
+                break;
+            }
             for (int i = 0; i < array->count; i++) {
-                markValue(array->elements[i], isMajor);
+                STORE_SHARED(array->elements[i], markValue(array->elements[i], isMajor));
             }
             break;
         }
         case OBJ_NATIVE:
         case OBJ_STRING:
+#ifdef NAN_BOXING
+        case OBJ_VECTOR2:
+#endif
         break;
     }
+
+    //Promoted objects can point at ones that stayed in the survivor space
+    if (hasYoungField && object->isTenured && !object->isQueued) {
+        appendRememberedSet(&vm.remSet, object);
+    }
 }
 
-static void traceReferences(bool isMajor) {
+static void traceReferences() {
     while (vm.grayCount > 0) {
         Obj* object = vm.grayStack[--vm.grayCount];
-        blackenObject(object, isMajor);
+        blackenObject(object, false);
     }
 }
 
-bool remSetChecker(Obj* object);
-
-static void sweep(bool isMajor) {
-    for (int i = 0; i < vm.remSet.count; i++) {
-        vm.remSet.objects[i]->isQueued = false;
+static void traceMarks() {
+    #ifdef PARALLEL_MARK
+    if (vm.markThreads > 1 && vm.markCount > 0) {
+        traceMarksParallel();
+        return;
     }
-    vm.remSet.count = 0;
+    #endif
+    while (vm.markCount > 0) {
+        Obj* object = vm.markStack[--vm.markCount];
+        blackenObject(object, true);
+    }
+}
 
-    Obj** cursor = &vm.objects;
-    while (*cursor != NULL) {
-        Obj* object = *cursor;
-        if (object->isMarked) {
-            object->isMarked = false;
-            *cursor = object->next;
-            promoteObject(object);
-        } 
-        else {
-            *cursor = object->next;
-            freeObject(object);
+double secondsSince(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+#ifndef CONCURRENT_MARK
+//Blackens gray objects until GC_SLICE_BUDGET runs out. Returns true once
+//nothing gray is left
+static bool traceMarkSlice() {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int work = 0;
+    while (vm.markCount > 0) {
+        Obj* object = vm.markStack[--vm.markCount];
+        blackenObject(object, true);
+
+        //Reading the clock costs more than most objects do
+        if (++work % 64 == 0 && secondsSince(&start) > GC_SLICE_BUDGET) {
+            return false;
         }
     }
+    return true;
+}
+#endif
 
-    if (isMajor) {
-        cursor = &vm.tenureObjects;
-        while (*cursor != NULL) {
-            Obj* object = *cursor;
-            if (object->isMarked) {
-                object->isMarked = false;
-                if(remSetChecker(object)){
-                    appendRememberedSet(&vm.remSet, object);
-                }
-                cursor = &object->next;
-            } 
-            else {
-                *cursor = object->next;
-                freeObject(object);
-            }
-        }
+//The sweep only starts here, the pages are swept later by sweepPages.
+//Objects allocated until it is done are marked, see allocateOld
+static void startSweep() {
+    vm.sweeping = true;
+    vm.sweepIndex = 0;
+    vm.sweepEnd = vm.slabPageCount;
+    pacerDeferSweep(vm.slabPageCount);
+}
+
+//Sweeps the next count pages in vm.slabPages order. A released page has
+//the last one moved into its slot, so the index only moves past pages
+//that are still there. The last page is a newer one unless there are none
+static size_t sweepPages(size_t count) {
+    if (!vm.sweeping) return 0;
+
+    size_t swept = 0;
+    while (vm.sweepIndex < vm.sweepEnd && swept < count) {
+        if (!slabSweep(vm.slabPages[vm.sweepIndex], freeObject)) vm.sweepIndex++;
+        if (vm.sweepEnd > vm.slabPageCount) vm.sweepEnd = vm.slabPageCount;
+        swept++;
     }
-    else{
-        cursor = &vm.tenureObjects;
-        while (*cursor != NULL){
-            Obj* object = *cursor;
-            if(remSetChecker(object)){
-                appendRememberedSet(&vm.remSet, object);
-            }
-            cursor = &object->next;
-        }
+    pacerRecordSweep(swept);
+
+    //Only now is the live size known. Counting what was allocated during the
+    //mark and the sweep would raise the next limit by it every cycle
+    if (vm.sweepIndex >= vm.sweepEnd) {
+        vm.sweeping = false;
+        size_t live = vm.bytesAllocatedTenure > vm.tenureUnjudged ?
+                      vm.bytesAllocatedTenure - vm.tenureUnjudged : 0;
+        size_t next = live * GC_HEAP_GROW_FACTOR;
+        vm.nextGCTenure = next < 1024 * 1024 ? 1024 * 1024 : next;
+        #ifdef DEBUG_LOG_GC
+        printf("-- sweep end, %zu bytes live, next major at %zu\n",
+                live, vm.nextGCTenure);
+        #endif
     }
+    return swept;
+}
+
+//The next mark clears the bits, so every unswept page is decided first
+static void finishSweep() {
+    sweepPages(SIZE_MAX);
+}
+
+//Sweeps for up to one slice. Meant for the idle time between frames
+void stepSweep() {
+    if (!vm.sweeping || vm.isGCing) return;
+
+    GCEvent event;
+    beginGCEvent(&event, GC_EVENT_SWEEP);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (sweepPages(GC_SWEEP_PAGES) > 0 &&
+           secondsSince(&start) < GC_SLICE_BUDGET);
+    endGCEvent(&event);
+
+    #ifdef DEBUG_LOG_TIME
+    vm.totalMajorTime += secondsSince(&start);
+    #endif
 }
 
 void appendRememberedSet(RememberedSet* set, Obj* object) {
@@ -310,145 +681,668 @@ void appendRememberedSet(RememberedSet* set, Obj* object) {
     set->count++;
 }
 
-void promoteObject(Obj* object) {
-    #ifdef DEBUG_MINOR_GC
-    return;
+void writeBarrier(Obj* source, Value value){
+    if(!IS_OBJ(value)) return;
+    Obj* target = OBJ_VALUE_TO_C(value);
+
+    #ifdef FRAME_ARENA
+    if (isFrameObject(target) && !isFrameObject(source)) recordFrameEscape(source);
     #endif
-    if (object->isTenured) return;
 
-    object->isTenured = true;
-    object->next = vm.tenureObjects;
-    vm.tenureObjects = object;
-    
-    size_t size = 0;
+    //Incremental update: an old object already scanned by the mark must not
+    //end up pointing at one that is still white
+    #ifndef CONCURRENT_MARK
+    if (vm.marking && source->isTenured) markObject(target, true);
+    #endif
+
+    if(source->isTenured && !target->isTenured && !source->isQueued){
+        source->isQueued = true;
+        appendRememberedSet(&vm.remSet, source);
+    }
+
+}
+
+//Arrays can be too long to rescan on every minor, so the store also dirties
+//the card holding the element
+void arrayWriteBarrier(ObjArray* array, int index, Value value) {
+    #ifdef FRAME_ARENA
+    if (IS_OBJ(value) && isFrameObject(OBJ_VALUE_TO_C(value)) &&
+        !isFrameObject((Obj*)array)) {
+        recordFrameEscape((Obj*)array);
+    }
+    #endif
+    if (!array->obj.isTenured || !IS_OBJ(value)) return;
+    #ifndef CONCURRENT_MARK
+    if (vm.marking) markObject(OBJ_VALUE_TO_C(value), true);
+    #endif
+    if (OBJ_VALUE_TO_C(value)->isTenured) return;
+
+    ensureCards(array);
+    array->cards[index / ARRAY_CARD_SIZE] = 1;
+    if (!array->obj.isQueued) appendRememberedSet(&vm.remSet, (Obj*)array);
+}
+
+#if defined(CONCURRENT_MARK) || defined(PARALLEL_MARK)
+#ifdef CONCURRENT_MARK
+//The VM may be storing into the object while the marker reads it
+#define LOAD_SHARED(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#else
+#define LOAD_SHARED(field) (field)
+#endif
+
+typedef void (*ShadeFn)(Obj* object, void* context);
+
+//The marker thread never starts under DEBUG_MINOR_GC
+#if defined(PARALLEL_MARK) || !defined(DEBUG_MINOR_GC)
+//Shades everything an old object points at. Only reads the object, mark
+//threads can't move young objects or store anything back. The mutator
+//publishes grown buffers before the shape or count that makes them visible
+static void traceFields(Obj* object, ShadeFn shade, void* context) {
     switch (object->type) {
-        case OBJ_FUNCTION: size = sizeof(ObjFunction); break;
-        case OBJ_NATIVE:   size = sizeof(ObjNative); break;
-        case OBJ_STRING:   size = sizeof(ObjString); break;
-        case OBJ_ENTITY:   size = sizeof(ObjEntity); break;
+        case OBJ_ENTITY:
+            shade((Obj*)((ObjEntity*)object)->name, context);
+            break;
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
-            size += sizeof(ObjInstance);
-            
-            size += instance->fields.capacity * sizeof(Entry);
+            shade((Obj*)instance->entity, context);
+            Shape* shape = LOAD_SHARED(instance->shape);
+            Value* fields = LOAD_SHARED(instance->fields);
+            for (int i = 0; i < shape->fieldCount; i++) {
+                Value value = LOAD_SHARED(fields[i]);
+                if (IS_OBJ(value)) shade(OBJ_VALUE_TO_C(value), context);
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            //Functions are finished before the script runs
+            ObjFunction* function = (ObjFunction*)object;
+            shade((Obj*)function->name, context);
+            for (int i = 0; i < function->chunk.constants.count; i++) {
+                Value value = LOAD_SHARED(function->chunk.constants.values[i]);
+                if (IS_OBJ(value)) shade(OBJ_VALUE_TO_C(value), context);
+            }
+            break;
+        }
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            int count = LOAD_SHARED(array->count);
+            Value* elements = LOAD_SHARED(array->elements);
+            for (int i = 0; i < count; i++) {
+                Value value = LOAD_SHARED(elements[i]);
+                if (IS_OBJ(value)) shade(OBJ_VALUE_TO_C(value), context);
+            }
             break;
         }
+        case OBJ_NATIVE:
+        case OBJ_STRING:
+#ifdef NAN_BOXING
+        case OBJ_VECTOR2:
+#endif
+            break;
+    }
+}
+#endif
+#endif
+
+#ifdef CONCURRENT_MARK
+#ifndef DEBUG_MINOR_GC
+//Where young objects can live. Fixed for the life of the VM, so the marker
+//can test an address without reading anything the mutator writes
+static bool isYoungAddress(Obj* object) {
+    #ifdef FRAME_ARENA
+    if (isFrameObject(object)) return true;
+    #endif
+    uint8_t* address = (uint8_t*)object;
+    for (int i = 0; i < 3; i++) {
+        if (address >= vm.youngSpaces[i] && address < vm.youngSpaceEnds[i]) return true;
     }
+    return false;
+}
 
-    vm.bytesAllocated -= size;
-    vm.bytesAllocatedTenure += size;
+//Everything below runs on the marker thread. It owns the mark stack while
+//it runs
+static void shadeConcurrent(Obj* object, void* unused) {
+    if (object == NULL || isYoungAddress(object)) return;
+    if (!slabSetMark(object)) return;
+    pushMark(object);
+}
 
-    bool pointsToYoung = remSetChecker(object);
-    if (pointsToYoung && !object->isQueued) {
-        appendRememberedSet(&vm.remSet, object);
+static void* runMarker(void* unused) {
+    for (;;) {
+        while (vm.markCount > 0) {
+            traceFields(vm.markStack[--vm.markCount], shadeConcurrent, NULL);
+        }
+
+        pthread_mutex_lock(&vm.snapshotLock);
+        int logged = vm.snapshotCount;
+        for (int i = 0; i < logged; i++) {
+            shadeConcurrent(vm.snapshotQueue[i], NULL);
+        }
+        vm.snapshotCount = 0;
+        pthread_mutex_unlock(&vm.snapshotLock);
+
+        if (logged == 0) break;
     }
 
+    //Anything logged from here on is picked up by the final pause
+    __atomic_store_n(&vm.markerDone, true, __ATOMIC_RELEASE);
+    return NULL;
 }
 
-static bool tableHasYoungObject(Table* table){
-    for(int i = 0; i < table->capacity; i++){
-        Entry* entry = &table->entries[i];
+static void startMarker() {
+    vm.youngSpaces[0] = vm.nursery;
+    vm.youngSpaceEnds[0] = vm.nurseryEnd;
+    vm.youngSpaces[1] = vm.survivorFrom;
+    vm.youngSpaceEnds[1] = vm.survivorFrom + SURVIVOR_SIZE;
+    vm.youngSpaces[2] = vm.survivorTo;
+    vm.youngSpaceEnds[2] = vm.survivorTo + SURVIVOR_SIZE;
 
-        if(entry->key == NULL) continue;
+    vm.markerDone = false;
+    if (pthread_create(&vm.marker, NULL, runMarker, NULL) != 0) {
+        //No thread, the final pause does all of the marking instead
+        vm.markerDone = true;
+        return;
+    }
+    vm.markerRunning = true;
+}
+#endif
 
-        if (IS_OBJ(entry->value)){
-            Obj* obj = OBJ_VALUE_TO_C(entry->value);
-            if(obj != NULL && !obj->isTenured){
-                return true;
-            }
-        }
+//Waits for the marker and takes back the mark stack. Whatever the barrier
+//logged after the marker stopped is marked by the caller
+static void joinMarker() {
+    if (vm.markerRunning) {
+        pthread_join(vm.marker, NULL);
+        vm.markerRunning = false;
+    }
+
+    for (int i = 0; i < vm.snapshotCount; i++) {
+        markObject(vm.snapshotQueue[i], true);
+    }
+    vm.snapshotCount = 0;
+
+    for (int i = 0; i < vm.retiredCount; i++) {
+        reallocate(vm.retired[i].pointer, vm.retired[i].size, 0);
+    }
+    vm.retiredCount = 0;
+}
+
+//Snapshot-at-the-beginning: a reference about to be overwritten in an old
+//object may be the only path the marker had to it, so it is logged first.
+//Objects newer than the snapshot are black and never need this
+void snapshotBarrier(Obj* source, Value oldValue) {
+    if (!vm.marking || !IS_OBJ(oldValue)) return;
+    if (source != NULL && !source->isTenured) return;
+
+    Obj* object = OBJ_VALUE_TO_C(oldValue);
+    if (!object->isTenured) return;
+    if (slabIsMarked(object)) return;
+
+    pthread_mutex_lock(&vm.snapshotLock);
+    if (vm.snapshotCapacity < vm.snapshotCount + 1) {
+        vm.snapshotCapacity = GROW_CAPACITY(vm.snapshotCapacity);
+        vm.snapshotQueue = (Obj**)realloc(vm.snapshotQueue,
+                                    sizeof(Obj*) * vm.snapshotCapacity);
+        if (vm.snapshotQueue == NULL) exit(1);
+    }
+    vm.snapshotQueue[vm.snapshotCount++] = object;
+    pthread_mutex_unlock(&vm.snapshotLock);
+}
+#endif
+
+#ifdef PARALLEL_MARK
+//Gray objects are split between the mark threads, each with its own stack.
+//A thread that runs dry steals half of someone else's
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    Obj** stack;
+    int count;
+    int capacity;
+} MarkWorker;
+
+//Most objects taken in one steal
+#define STEAL_MAX 256
+
+static MarkWorker* workers;
+static int workerCount;
+static int idleWorkers;
+static bool workersStarted;
+
+static void growWork(MarkWorker* worker, int needed) {
+    if (worker->capacity >= needed) return;
+    while (worker->capacity < needed) worker->capacity = GROW_CAPACITY(worker->capacity);
+    worker->stack = (Obj**)realloc(worker->stack, sizeof(Obj*) * worker->capacity);
+    if (worker->stack == NULL) exit(1);
+}
+
+//The count is read without the lock by threads looking for work
+static void pushWork(MarkWorker* worker, Obj* object) {
+    pthread_mutex_lock(&worker->lock);
+    growWork(worker, worker->count + 1);
+    worker->stack[worker->count] = object;
+    __atomic_store_n(&worker->count, worker->count + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&worker->lock);
+}
+
+static Obj* popWork(MarkWorker* worker) {
+    Obj* object = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count > 0) {
+        __atomic_store_n(&worker->count, worker->count - 1, __ATOMIC_RELAXED);
+        object = worker->stack[worker->count];
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return object;
+}
+
+//Takes from the bottom of the victim's stack, the oldest entries, which
+//tend to have the most left under them. Returns one, keeps the rest
+static Obj* stealWork(MarkWorker* thief) {
+    int self = (int)(thief - workers);
+    for (int i = 1; i < workerCount; i++) {
+        MarkWorker* victim = &workers[(self + i) % workerCount];
+        if (__atomic_load_n(&victim->count, __ATOMIC_RELAXED) == 0) continue;
+
+        Obj* stolen[STEAL_MAX];
+        pthread_mutex_lock(&victim->lock);
+        int take = (victim->count + 1) / 2;
+        if (take > STEAL_MAX) take = STEAL_MAX;
+        memcpy(stolen, victim->stack, sizeof(Obj*) * take);
+        memmove(victim->stack, victim->stack + take,
+                sizeof(Obj*) * (victim->count - take));
+        __atomic_store_n(&victim->count, victim->count - take, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&victim->lock);
+
+        if (take == 0) continue;
+        pthread_mutex_lock(&thief->lock);
+        growWork(thief, thief->count + take - 1);
+        memcpy(thief->stack + thief->count, stolen + 1, sizeof(Obj*) * (take - 1));
+        __atomic_store_n(&thief->count, thief->count + take - 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&thief->lock);
+        return stolen[0];
+    }
+    return NULL;
+}
+
+static bool anyWork() {
+    for (int i = 0; i < workerCount; i++) {
+        if (__atomic_load_n(&workers[i].count, __ATOMIC_RELAXED) > 0) return true;
     }
     return false;
 }
-bool remSetChecker(Obj* object){
-    switch(object->type) {
-        case OBJ_FUNCTION: {
-            ObjFunction* function = (ObjFunction*)object;
-            if (function->name != NULL && !function->name->obj.isTenured) {
-                return true;
-            }
-            
-            for (int i = 0; i < function->chunk.constants.count; i++) {
-                Value constant = function->chunk.constants.values[i];
-                if (IS_OBJ(constant)) {
-                    Obj* constObj = OBJ_VALUE_TO_C(constant);
-                    if (!constObj->isTenured) {
-                        return true;
-                    }
-                }
+
+static void shadeParallel(Obj* object, void* worker) {
+    if (object == NULL || !slabSetMark(object)) return;
+    pushWork((MarkWorker*)worker, object);
+}
+
+//A thread only pushes to its own stack, and only goes idle once that is
+//empty, so when every thread is idle there is nothing left anywhere
+static void drainWork(MarkWorker* worker) {
+    for (;;) {
+        Obj* object = popWork(worker);
+        if (object == NULL) object = stealWork(worker);
+        if (object != NULL) {
+            traceFields(object, shadeParallel, worker);
+            continue;
+        }
+
+        __atomic_add_fetch(&idleWorkers, 1, __ATOMIC_ACQ_REL);
+        for (;;) {
+            if (__atomic_load_n(&idleWorkers, __ATOMIC_ACQUIRE) == workerCount) return;
+            if (anyWork()) {
+                __atomic_sub_fetch(&idleWorkers, 1, __ATOMIC_ACQ_REL);
+                break;
             }
-            return false;
+            sched_yield();
         }
-        case OBJ_ENTITY: {
-            ObjEntity* entity = (ObjEntity*)object;
-             if (!entity->name->obj.isTenured) return true;
-             return false;
+    }
+}
+
+static void* runMarkWorker(void* worker) {
+    while (!__atomic_load_n(&workersStarted, __ATOMIC_ACQUIRE)) sched_yield();
+    drainWork((MarkWorker*)worker);
+    return NULL;
+}
+
+//Drains the mark stack on vm.markThreads threads, this one included. Only
+//for stop-the-world marking: nothing is young and nothing else runs, so
+//the threads can read the heap without the mutator's ordering
+static void traceMarksParallel() {
+    int threads = vm.markThreads > GC_MAX_MARK_THREADS ?
+                    GC_MAX_MARK_THREADS : vm.markThreads;
+    workers = (MarkWorker*)calloc(threads, sizeof(MarkWorker));
+    if (workers == NULL) exit(1);
+
+    //Threads that fail to start are left out, down to this one alone
+    workersStarted = false;
+    workerCount = 1;
+    pthread_mutex_init(&workers[0].lock, NULL);
+    for (int i = 1; i < threads; i++) {
+        MarkWorker* worker = &workers[workerCount];
+        pthread_mutex_init(&worker->lock, NULL);
+        if (pthread_create(&worker->thread, NULL, runMarkWorker, worker) != 0) {
+            pthread_mutex_destroy(&worker->lock);
+            break;
         }
-        case OBJ_INSTANCE: {
-            ObjInstance* instance = (ObjInstance*)object;
-            
-            // 1. If the Entity (class name) is young, we must remember it
-            if (!instance->entity->obj.isTenured) return true;
-            
-            // 2. Scan the fields (x, y) for young objects using the helper above
-            return tableHasYoungObject(&instance->fields);
+        workerCount++;
+    }
+
+    for (int i = 0; i < vm.markCount; i++) {
+        MarkWorker* worker = &workers[i % workerCount];
+        growWork(worker, worker->count + 1);
+        worker->stack[worker->count++] = vm.markStack[i];
+    }
+    vm.markCount = 0;
+    idleWorkers = 0;
+    __atomic_store_n(&workersStarted, true, __ATOMIC_RELEASE);
+
+    drainWork(&workers[0]);
+
+    for (int i = 0; i < workerCount; i++) {
+        if (i > 0) pthread_join(workers[i].thread, NULL);
+        pthread_mutex_destroy(&workers[i].lock);
+        free(workers[i].stack);
+    }
+    free(workers);
+    workers = NULL;
+}
+#endif
+
+//Frees a buffer an old object stopped using. The marker thread may still be
+//reading it, in which case it is kept until the mark is finished
+void retireBuffer(Obj* owner, void* pointer, size_t size) {
+    #ifdef CONCURRENT_MARK
+    if (vm.markerRunning && owner->isTenured) {
+        if (vm.retiredCapacity < vm.retiredCount + 1) {
+            vm.retiredCapacity = GROW_CAPACITY(vm.retiredCapacity);
+            vm.retired = (RetiredBuffer*)realloc(vm.retired,
+                                    sizeof(RetiredBuffer) * vm.retiredCapacity);
+            if (vm.retired == NULL) exit(1);
         }
-        case OBJ_NATIVE:
-        case OBJ_STRING:
-        default:
-            return false;
+        vm.retired[vm.retiredCount].pointer = pointer;
+        vm.retired[vm.retiredCount].size = size;
+        vm.retiredCount++;
+        return;
     }
+    #endif
+    reallocate(pointer, size, 0);
 }
 
-void writeBarrier(Obj* source, Value value){
-    if(!IS_OBJ(value)) return;
-    Obj* target = OBJ_VALUE_TO_C(value);
+//Copies everything reachable in the nursery and the survivor space being
+//emptied into the other survivor space or the old generation. Costs nothing
+//for the young objects that died
+static void evacuateNursery(bool promoteAll) {
+    vm.promoteAll = promoteAll;
+    vm.survivorTop = vm.survivorTo;
+    vm.survivorEnd = vm.survivorTo + SURVIVOR_SIZE;
 
-    if(source->isTenured && !target->isTenured && !source->isQueued){
-        source->isQueued = true;
-        appendRememberedSet(&vm.remSet, source);
+    markRoots(false);
+    traceReferences();
+
+    tableRemoveWhite(&vm.strings, false);
+    sweepYoungBuffers();
+
+    uint8_t* survivors = vm.survivorTo;
+    vm.survivorTo = vm.survivorFrom;
+    vm.survivorFrom = survivors;
+
+    vm.nurseryTop = vm.nursery;
+    vm.bytesAllocated = vm.survivorTop - vm.survivorFrom;
+    #ifdef PROFILE_ALLOCATIONS
+    profileYoungDecided(true, true);
+    #endif
+
+    #ifdef FRAME_ARENA
+    //The arena is young space like the nursery, its survivors just moved
+    vm.frameArenaTop = vm.frameArena;
+    vm.frameOverflowed = false;
+    vm.frameStrings = false;
+    vm.frameEscapeCount = 0;
+    #endif
+}
+
+void beginFrameArena() {
+    #ifdef FRAME_ARENA
+    vm.frameArenaActive = true;
+    #endif
+}
+
+//Everything draw() allocated is dropped at once. Only the globals, the
+//stack and the objects the barriers listed can point into the arena now,
+//so only what they reach is copied out, into the survivor space like a
+//minor would. A frame that stored nothing costs nothing
+void endFrameArena() {
+    #ifdef FRAME_ARENA
+    vm.frameArenaActive = false;
+    if (vm.frameArenaTop == vm.frameArena) return;
+
+    //Nursery objects made since the spill were never listed
+    if (vm.frameOverflowed) {
+        collectGarbage(false);
+        return;
+    }
+
+    #ifdef DEBUG_LOG_GC
+    printf("-- frame arena end, %zu bytes, %d escapes\n",
+            (size_t)(vm.frameArenaTop - vm.frameArena), vm.frameEscapeCount);
+    #endif
+
+    GCEvent event;
+    beginGCEvent(&event, GC_EVENT_FRAME);
+    vm.isGCing = true;
+    vm.evacuatingFrame = true;
+    vm.promoteAll = false;
+    uint8_t* survivorTop = vm.survivorTop;
+
+    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        *slot = markValue(*slot, false);
     }
+    markArray(&vm.globalValues, false);
+    markShapes(false);
+    for (int i = 0; i < vm.frameEscapeCount; i++) {
+        blackenObject(vm.frameEscapes[i], false);
+    }
+    traceReferences();
+
+    if (vm.frameStrings) tableRemoveWhite(&vm.strings, false);
+    sweepYoungBuffers();
 
+    vm.evacuatingFrame = false;
+    vm.bytesAllocated += vm.survivorTop - survivorTop;
+    vm.frameArenaTop = vm.frameArena;
+    #ifdef PROFILE_ALLOCATIONS
+    profileYoungDecided(false, true);
+    #endif
+    vm.frameStrings = false;
+    vm.frameEscapeCount = 0;
+    vm.isGCing = false;
+    endGCEvent(&event);
+    #endif
 }
 
 void collectGarbage(bool isMajor) {
     #ifdef DEBUG_LOG_GC
     printf("-- gc begin (%s)\n", isMajor ? "major" : "minor");
-    size_t before = vm.bytesAllocated;
+    size_t before = vm.bytesAllocated + vm.bytesAllocatedTenure;
 
     #endif
     if(vm.isGCing) return;
+    GCEvent event;
+    beginGCEvent(&event, isMajor ? GC_EVENT_MAJOR : GC_EVENT_MINOR);
     vm.isGCing = true;
-    
-    #ifdef DEBUG_MINOR_GC
-    isMajor = true;
-    #endif
+    vm.isMajor = isMajor;
+
+    //Clearing the marks is skipped when an incremental mark is finishing
+    if (isMajor && !vm.marking) {
+        finishSweep();
+        slabClearMarks();
+        vm.tenureUnjudged = 0;
+    }
 
-    markRoots(isMajor);
-    traceReferences(isMajor);
-    tableRemoveWhite(&vm.strings, isMajor);
-    sweep(isMajor);
+    //A major collection promotes everything young first, then only has to
+    //trace and sweep the old generation. It judges what it promotes
+    size_t tenureBefore = vm.bytesAllocatedTenure;
+    size_t unjudged = vm.tenureUnjudged;
+    evacuateNursery(isMajor);
+    if (isMajor) vm.tenureUnjudged = unjudged;
 
     if(isMajor) {
-        vm.nextGCTenure = vm.bytesAllocatedTenure * GC_HEAP_GROW_FACTOR;
-        #ifdef DEBUG_MINOR_GC
-        size_t next = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
-        vm.nextGC = next < 1024 * 1024 ? 1024 * 1024 : next;
+        #ifdef CONCURRENT_MARK
+        joinMarker();
         #endif
+        //Also finishes an incremental mark. Roots are not behind a barrier,
+        //so they are marked again before the sweep
+        markRoots(true);
+        traceMarks();
+        tableRemoveWhite(&vm.strings, true);
+        startSweep();
+        vm.marking = false;
     }
     else {
-        vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+        //Promotion happens with isGCing set, so countTenure leaves the sweep
+        //alone. Without frames nothing else would advance it, and no major
+        //can start until it is done, so each minor sweeps ahead of what it
+        //promoted
+        if (vm.sweeping && vm.bytesAllocatedTenure > tenureBefore) {
+            size_t promoted = vm.bytesAllocatedTenure - tenureBefore;
+            size_t promotedPages = (promoted + SLAB_PAGE_SIZE - 1) / SLAB_PAGE_SIZE;
+            sweepPages(GC_SWEEP_PER_PROMOTED * promotedPages);
+        }
+
+        //Promotion filled the old generation, collect it at the next safepoint
+        if (!vm.marking && !vm.sweeping && vm.bytesAllocatedTenure > vm.nextGCTenure) {
+            vm.gcRequested = true;
+            vm.majorRequested = true;
+        }
     }
 
     #ifdef DEBUG_LOG_GC
     printf("-- gc end\n");
 
-    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
-            before - vm.bytesAllocated, before, vm.bytesAllocated,
-            vm.nextGC);
+    printf("   collected %zu bytes (from %zu to %zu) next major at %zu\n",
+            before - vm.bytesAllocatedTenure, before, vm.bytesAllocatedTenure,
+            vm.nextGCTenure);
+
+    #endif
+    vm.isGCing = false;
+    endGCEvent(&event);
+}
 
+#ifdef INCREMENTAL_GC
+#ifndef DEBUG_MINOR_GC
+//Promotes everything young, so the whole heap can be traced incrementally,
+//then marks the roots. The rest is left to the slices
+static void startMarking() {
+    #ifdef DEBUG_LOG_GC
+    printf("-- gc start marking\n");
+    #endif
+    GCEvent event;
+    beginGCEvent(&event, GC_EVENT_MARK_START);
+    vm.isGCing = true;
+    finishSweep();
+    slabClearMarks();
+    evacuateNursery(true);
+    vm.tenureUnjudged = 0;
+    vm.marking = true;
+    markRoots(true);
+    #ifdef CONCURRENT_MARK
+    startMarker();
     #endif
     vm.isGCing = false;
+    endGCEvent(&event);
+}
+#endif
+
+//Does the next bit of marking, true once there is none left. The concurrent
+//marker does its work on its own, this only asks whether it is done
+static bool advanceMark() {
+    #ifdef CONCURRENT_MARK
+    return __atomic_load_n(&vm.markerDone, __ATOMIC_ACQUIRE);
+    #else
+    GCEvent event;
+    beginGCEvent(&event, GC_EVENT_MARK_SLICE);
+    bool done = traceMarkSlice();
+    endGCEvent(&event);
+    return done;
+    #endif
 }
 
+#ifndef DEBUG_MINOR_GC
+//Minors stay stop-the-world, they are short. A major request only starts a
+//mark, and every later minor also advances it by one slice
+static void collectIncrementally(bool isMajor) {
+    if (vm.marking && isMajor) {
+        collectGarbage(true);
+        return;
+    }
 
+    if (!vm.marking && isMajor) {
+        startMarking();
+    } else {
+        collectGarbage(false);
+    }
+    if (vm.marking && advanceMark()) collectGarbage(true);
+}
+#endif
+#endif
+
+//Advances an unfinished mark by one slice. Meant for the idle time between
+//frames; does nothing when no mark is in progress
+void stepMarking() {
+    if (!vm.marking || vm.isGCing) return;
+
+    #ifdef DEBUG_LOG_TIME
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    #endif
+
+    #ifdef INCREMENTAL_GC
+    if (advanceMark()) collectGarbage(true);
+    #endif
+
+    #ifdef DEBUG_LOG_TIME
+    vm.totalMajorTime += secondsSince(&start);
+    #endif
+}
+
+//Runs whatever collection was asked for since the last safepoint
+void collectRequested() {
+    bool isMajor = vm.majorRequested;
+    bool isMinor = vm.minorRequested;
+    vm.gcRequested = false;
+    vm.majorRequested = false;
+    vm.minorRequested = false;
+
+    #ifdef DEBUG_MINOR_GC
+    isMajor = true;
+    #endif
+
+    //A frame close to its deadline gets more heap instead of a major
+    bool startsMajor = isMajor && !vm.marking;
+    if (startsMajor && pacerDeferMajor()) {
+        if (!isMinor) return;
+        isMajor = false;
+        startsMajor = false;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    #if defined(INCREMENTAL_GC) && !defined(DEBUG_MINOR_GC)
+    collectIncrementally(isMajor);
+    #else
+    collectGarbage(isMajor);
+    #endif
+
+    double elapsed = secondsSince(&start);
+    if (startsMajor) pacerRecordMajor(elapsed);
+
+    #ifdef DEBUG_LOG_TIME
+    if (isMajor || vm.marking) {
+        vm.totalMajorTime += elapsed;
+    } else {
+        vm.totalMinorTime += elapsed;
+    }
+    #endif
+}
@@ -1,6 +1,8 @@
 #ifndef graphiC_memory_h
 #define graphiC_memory_h
 
+#include <time.h>
+
 #include "common.h"
 #include "object.h"
 #include "value.h"
@@ -20,14 +22,85 @@
 
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
+#define NURSERY_SIZE (1024 * 1024)
+#define SURVIVOR_SIZE (NURSERY_SIZE / 4)
+
+//Room draw() has for its young objects with FRAME_ARENA, once it runs out
+//they go to the nursery until a minor empties the arena
+#ifndef FRAME_ARENA_SIZE
+#define FRAME_ARENA_SIZE (NURSERY_SIZE / 2)
+#endif
+
+//Longest an incremental mark slice runs, in seconds
+#ifndef GC_SLICE_BUDGET
+#define GC_SLICE_BUDGET 0.0005
+#endif
+
+//Slab pages swept per allocation while a lazy sweep is unfinished
+#ifndef GC_SWEEP_PAGES
+#define GC_SWEEP_PAGES 1
+#endif
+
+//Slab pages a minor sweeps for each page it promoted while a lazy sweep is
+//unfinished. Promotion is all a program that never reaches draw() does to
+//the old generation, and no major can start before the sweep is done
+#ifndef GC_SWEEP_PER_PROMOTED
+#define GC_SWEEP_PER_PROMOTED 8
+#endif
+
+//Threads the stop-the-world mark uses with PARALLEL_MARK, unless main
+//sets vm.markThreads to something else
+#ifndef GC_MARK_THREADS
+#define GC_MARK_THREADS 4
+#endif
+#define GC_MAX_MARK_THREADS 64
+
+//Elements covered by one dirty byte of a tenured array
+#define ARRAY_CARD_SIZE 128
+
+//How many minor collections a young object has to survive before it is
+//copied into the old generation instead of the other survivor space
+#ifndef GC_TENURE_AGE
+#define GC_TENURE_AGE 2
+#endif
+
+//Young objects move when they are marked, so every reference the GC visits
+//has to be stored back
+#define MARK_OBJECT(field, isMajor) \
+    ((field) = (void*)markObject((Obj*)(field), (isMajor)))
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
-void markObject(Obj* object, bool isMajor);
-void markValue(Value value, bool isMajor);
+Obj* allocateYoung(size_t size);
+Obj* allocateTenured(size_t size);
+void trackYoungBuffer(Obj* object);
+Obj* forwardingAddress(Obj* object);
+Obj* markObject(Obj* object, bool isMajor);
+Value markValue(Value value, bool isMajor);
 void collectGarbage(bool isMajor);
+void collectRequested();
+void stepMarking();
+void stepSweep();
+void beginFrameArena();
+void endFrameArena();
 void freeObjects();
+double secondsSince(struct timespec* start);
 
-void promoteObject(Obj* object);
 void appendRememberedSet(RememberedSet* set, Obj* object);
 void writeBarrier(Obj* source, Value value);
+void retireBuffer(Obj* owner, void* pointer, size_t size);
+
+#ifdef CONCURRENT_MARK
+void snapshotBarrier(Obj* source, Value oldValue);
+//Stores a pointer or count the marker thread reads, after what it guards
+#define PUBLISH(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+//Stores a Value the marker thread may be reading at the same time. Release,
+//so a freshly promoted object is complete before the marker can find it
+#define STORE_SHARED(slot, value) __atomic_store_n(&(slot), (value), __ATOMIC_RELEASE)
+#else
+#define snapshotBarrier(source, oldValue) ((void)0)
+#define PUBLISH(field, value) ((field) = (value))
+#define STORE_SHARED(slot, value) ((slot) = (value))
+#endif
+void arrayWriteBarrier(ObjArray* array, int index, Value value);
 
 #endif
\ No newline at end of file
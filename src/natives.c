@@ -5,43 +5,16 @@
 
 Value nativeVector2(int argCount, Value* args){
     if (argCount !=2) return C_TO_NULL_VALUE;
+    if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) return C_TO_NULL_VALUE;
 
-    ObjInstance* instance = newInstance(vm.vector2Entity);
-
-    push(C_TO_OBJ_VALUE(instance));
-
-    tableSet(&instance->fields, vm.strX, args[0]);
-    tableSet(&instance->fields, vm.strY, args[1]);
-
-    pop();
-    
-    return C_TO_OBJ_VALUE(instance);
-
+    return C_TO_VECTOR2_VALUE((float)NUMBER_VALUE_TO_C(args[0]),
+                              (float)NUMBER_VALUE_TO_C(args[1]));
 }
 
 Vector2 valueToVector2(Value value){
-    if (!IS_INSTANCE(value)) return (Vector2){0, 0};
-    ObjInstance* instance = AS_INSTANCE(value);
-    
-    if(strcmp(instance->entity->name->chars, "Vector2") != 0) return (Vector2){0, 0};
-
-    Vector2 vec;
-    Value val;
-
-    if(tableGet(&instance->fields, vm.strX, &val)) {
-        vec.x = (float)NUMBER_VALUE_TO_C(val);
-    }
-    else {
-        vec.x = 0.0f;
-    }
+    if (!IS_VECTOR2(value)) return (Vector2){0, 0};
 
-    if (tableGet(&instance->fields, vm.strY, &val)) {
-        vec.y = (float)NUMBER_VALUE_TO_C(val);
-    } else {
-        vec.y = 0.0f;
-    }
-
-    return vec;
+    return (Vector2){VECTOR2_X(value), VECTOR2_Y(value)};
 }
 
 Value nativeInitWindow(int argCount, Value* args){
@@ -66,58 +39,30 @@ Value nativeCloseWindow(int argCount, Value* args){
 }
 
 
-Value nativeColor(int argCount, Value* args) {
-    if (argCount != 4) return C_TO_NULL_VALUE;
-
-    ObjInstance* instance = newInstance(vm.colorEntity);
-
-    // Anchor the instance so the GC doesn't free it during tableSet
-    push(C_TO_OBJ_VALUE(instance));
-
-    tableSet(&instance->fields, vm.strR, args[0]);
-    tableSet(&instance->fields, vm.strG, args[1]);
-    tableSet(&instance->fields, vm.strB, args[2]);
-    tableSet(&instance->fields, vm.strA, args[3]);
+//Clamps to 0-255, casting an out of range double straight to a char is undefined
+uint8_t valueToChannel(Value value) {
+    if (!IS_NUMBER(value)) return 0;
 
-    // Remove the anchor
-    pop();
-
-    return C_TO_OBJ_VALUE(instance);
+    double channel = NUMBER_VALUE_TO_C(value);
+    if (channel <= 0) return 0;
+    if (channel >= 255) return 255;
+    return (uint8_t)channel;
 }
 
+Value nativeColor(int argCount, Value* args) {
+    if (argCount != 4) return C_TO_NULL_VALUE;
 
-
-
-
+    return C_TO_COLOR_VALUE(PACK_COLOR(valueToChannel(args[0]), valueToChannel(args[1]),
+                                       valueToChannel(args[2]), valueToChannel(args[3])));
+}
 
 Color valueToColor(Value value) {
     // Default to Black (opaque) if the cast fails
-    if (!IS_INSTANCE(value)) return (Color){0, 0, 0, 255}; 
-    ObjInstance* instance = AS_INSTANCE(value);
-    
-    if (strcmp(instance->entity->name->chars, "Color") != 0) return (Color){0, 0, 0, 255};
-
-    Color color;
-    Value val;
+    if (!IS_COLOR(value)) return (Color){0, 0, 0, 255}; 
 
-    // Raylib Colors use unsigned chars (0-255)
-    if (tableGet(&instance->fields, vm.strR, &val)) {
-        color.r = (unsigned char)NUMBER_VALUE_TO_C(val);
-    } else color.r = 0;
-
-    if (tableGet(&instance->fields, vm.strG, &val)) {
-        color.g = (unsigned char)NUMBER_VALUE_TO_C(val);
-    } else color.g = 0;
-
-    if (tableGet(&instance->fields, vm.strB, &val)) {
-        color.b = (unsigned char)NUMBER_VALUE_TO_C(val);
-    } else color.b = 0;
-
-    if (tableGet(&instance->fields, vm.strA, &val)) {
-        color.a = (unsigned char)NUMBER_VALUE_TO_C(val);
-    } else color.a = 255; // Default alpha to 255 (visible)
-
-    return color;
+    uint32_t rgba = COLOR_VALUE_TO_C(value);
+    return (Color){COLOR_CHANNEL(rgba, 0), COLOR_CHANNEL(rgba, 1),
+                   COLOR_CHANNEL(rgba, 2), COLOR_CHANNEL(rgba, 3)};
 }
 
 Value NativeClearBackground(int argCount, Value* args){
@@ -141,7 +86,9 @@ Value NativeBeginDrawing(int argCount, Value* args){
 Value NativeEndDrawing(int argCount, Value* args){
     if(argCount != 0) return C_TO_NULL_VALUE;
 
+    pacerBeginWait();
     EndDrawing();
+    pacerEndWait();
 
     return C_TO_NULL_VALUE;
 }
@@ -187,20 +134,7 @@ Value NativeGetMousePosition(int argCount, Value* args){
     // Call the Raylib function
     Vector2 mousePos = GetMousePosition();
 
-    // Create a new graphiC Vector2 instance
-    ObjInstance* instance = newInstance(vm.vector2Entity);
-
-    // Anchor the instance to protect it from the GC during tableSet
-    push(C_TO_OBJ_VALUE(instance));
-
-    // Convert the C floats to VM Number Values and set the fields
-    tableSet(&instance->fields, vm.strX, C_TO_NUMBER_VALUE(mousePos.x));
-    tableSet(&instance->fields, vm.strY, C_TO_NUMBER_VALUE(mousePos.y));
-
-    // Remove the GC anchor
-    pop();
-
-    return C_TO_OBJ_VALUE(instance);
+    return C_TO_VECTOR2_VALUE(mousePos.x, mousePos.y);
 }
 
 Value nativeIsMouseButtonPressed(int argCount, Value* args) {
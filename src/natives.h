@@ -15,6 +15,7 @@ Value nativeInitWindow(int argCount, Value* args);
 Value nativeCloseWindow(int argCount, Value* args);
 Value nativeColor(int argCount, Value* args);
 Color valueToColor(Value value);
+uint8_t valueToChannel(Value value);
 //void ClearBackground(Color color);           
 Value NativeClearBackground(int argCount, Value* args);
 Value NativeBeginDrawing(int argCount, Value* args);                
@@ -12,14 +12,22 @@
     (type*)allocateObject(sizeof(type), objectType) 
 
 static Obj* allocateObject(size_t size, ObjType type) {
-    Obj* object = (Obj*)reallocate(NULL, 0, size);
+    Obj* object = NULL;
+    //Entities, functions and natives live as long as the script does, so
+    //they skip the nursery
+    if (type != OBJ_ENTITY && type != OBJ_FUNCTION && type != OBJ_NATIVE) {
+        object = allocateYoung(size);
+    }
+    if (object == NULL) {
+        object = allocateTenured(size);
+    }
     object->type = type;
+    vm.gcLog.allocations++;
+    vm.gcLog.allocatedBytes += size;
 
-    object->isMarked = false;
-    object->isTenured = false;
-    object->isQueued = false;
-    object->next = vm.objects;
-    vm.objects = object;
+    #ifdef PROFILE_ALLOCATIONS
+    profileAllocation(object, size);
+    #endif
 
     #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -30,15 +38,21 @@ static Obj* allocateObject(size_t size, ObjType type) {
 }
 
 
-static ObjString* allocateString(char* chars, int length, uint32_t hash){
-    ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+static ObjString* allocateString(const char* chars, int length, uint32_t hash){
+    ObjString* string = (ObjString*)allocateObject(
+        sizeof(ObjString) + length + 1, OBJ_STRING);
     string->length = length;
-    string->chars = chars;
     string->hash = hash;
+    memcpy(string->chars, chars, length);
+    string->chars[length] = '\0';
 
     push(C_TO_OBJ_VALUE(string));
     tableSet(&vm.strings, string, C_TO_NULL_VALUE);
     pop();
+    #ifdef FRAME_ARENA
+    //The table is weak, the arena has to take its strings back out
+    if (isFrameObject((Obj*)string)) vm.frameStrings = true;
+    #endif
     
     return string;
 }
@@ -46,16 +60,69 @@ static ObjString* allocateString(char* chars, int length, uint32_t hash){
 ObjEntity* newEntity(ObjString* name) {
     ObjEntity* entity = ALLOCATE_OBJ(ObjEntity, OBJ_ENTITY);
     entity->name = name;
+    entity->inlineFields = 0;
     return entity;
 }
 
 ObjInstance* newInstance(ObjEntity* entity) {
-    ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
+    int inlineCapacity = entity->inlineFields;
+    ObjInstance* instance = (ObjInstance*)allocateObject(
+        INSTANCE_SIZE(inlineCapacity), OBJ_INSTANCE);
     instance->entity = entity;
-    initTable(&instance->fields);
+    instance->shape = vm.rootShape;
+    instance->fields = instance->inlineFields;
+    instance->fieldCapacity = inlineCapacity;
+    instance->inlineCapacity = inlineCapacity;
     return instance;
 }
 
+bool instanceGetField(ObjInstance* instance, ObjString* name, Value* value) {
+    int index = shapeFieldIndex(instance->shape, name);
+    if (index == -1) return false;
+
+    *value = instance->fields[index];
+    return true;
+}
+
+//The caller keeps instance and value reachable, adding a field can allocate
+void instanceSetField(ObjInstance* instance, ObjString* name, Value value) {
+    int index = shapeFieldIndex(instance->shape, name);
+    if (index != -1) {
+        snapshotBarrier((Obj*)instance, instance->fields[index]);
+        STORE_SHARED(instance->fields[index], value);
+        return;
+    }
+
+    Shape* shape = shapeAddField(instance->shape, name);
+    index = shape->fieldCount - 1;
+
+    if (index >= instance->fieldCapacity) {
+        int oldCapacity = instance->fieldCapacity;
+        //GROW_CAPACITY starts at 8, most entities never get near that
+        int capacity = oldCapacity < 4 ? 4 : oldCapacity * 2;
+
+        Value* fields = ALLOCATE(Value, capacity);
+        for (int i = 0; i < instance->shape->fieldCount; i++) {
+            fields[i] = instance->fields[i];
+        }
+        Value* oldFields = instance->fields;
+        PUBLISH(instance->fields, fields);
+        instance->fieldCapacity = capacity;
+        if (oldFields != instance->inlineFields) {
+            retireBuffer((Obj*)instance, oldFields, sizeof(Value) * oldCapacity);
+        }
+        else if (!instance->obj.isTenured) {
+            trackYoungBuffer((Obj*)instance);
+        }
+    }
+
+    STORE_SHARED(instance->fields[index], value);
+    PUBLISH(instance->shape, shape);
+    if (shape->fieldCount > instance->entity->inlineFields) {
+        instance->entity->inlineFields = shape->fieldCount;
+    }
+}
+
 ObjFunction* newFunction() {
     ObjFunction* function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
 
@@ -83,29 +150,34 @@ static uint32_t hashString(const char* key, int length){
     return hash;
 }
 
+//The string table is weak, so a lookup can hand back a string the snapshot
+//mark no longer reaches. It has to be kept alive like an overwritten field
+static ObjString* findInterned(const char* chars, int length, uint32_t hash) {
+    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    if (interned != NULL) snapshotBarrier(NULL, C_TO_OBJ_VALUE(interned));
+    return interned;
+}
+
 ObjString* takeString(char* chars, int length){
     uint32_t hash = hashString(chars, length);
 
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
-    if(interned != NULL) {
-        FREE_ARRAY(char, chars, length + 1);
-        return interned;
+    ObjString* interned = findInterned(chars, length, hash);
+    if(interned == NULL) {
+        interned = allocateString(chars, length, hash);
     }
 
-    return allocateString(chars, length, hash);
+    //The characters are copied into the string, so the buffer is always freed
+    FREE_ARRAY(char, chars, length + 1);
+    return interned;
 }
 
 ObjString* copyString(const char* chars, int length){
     uint32_t hash = hashString(chars, length);
 
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString* interned = findInterned(chars, length, hash);
     if (interned != NULL) return interned;
 
-    char* heapChars = ALLOCATE(char, length + 1);
-    memcpy(heapChars, chars, length);
-    heapChars[length] = '\0';
-
-    return allocateString(heapChars, length, hash);
+    return allocateString(chars, length, hash);
 }
 
 ObjArray* newArray() {
@@ -113,17 +185,57 @@ ObjArray* newArray() {
     array->count = 0;
     array->capacity = 0;
     array->elements = NULL;
+    array->cards = NULL;
+    array->cardCount = 0;
     return array;
 }
 
+#ifdef NAN_BOXING
+ObjVector2* newVector2(float x, float y) {
+    ObjVector2* vector = vm.scratchTarget;
+    if (vector != NULL) {
+        vm.scratchTarget = NULL;
+    } else {
+        vector = ALLOCATE_OBJ(ObjVector2, OBJ_VECTOR2);
+    }
+    vector->x = x;
+    vector->y = y;
+    return vector;
+}
+#endif
+
 void arrayWrite(ObjArray* array, Value value) {
     if (array->capacity < array->count + 1) {
         int oldCapacity = array->capacity;
-        array->capacity = GROW_CAPACITY(oldCapacity);
-        array->elements = GROW_ARRAY(Value, array->elements, oldCapacity, array->capacity);
+        int capacity = GROW_CAPACITY(oldCapacity);
+        Value* elements = ALLOCATE(Value, capacity);
+        if (array->count > 0) {
+            memcpy(elements, array->elements, sizeof(Value) * array->count);
+        }
+
+        Value* oldElements = array->elements;
+        PUBLISH(array->elements, elements);
+        array->capacity = capacity;
+        if (oldCapacity == 0 && !array->obj.isTenured) trackYoungBuffer((Obj*)array);
+        retireBuffer((Obj*)array, oldElements, sizeof(Value) * oldCapacity);
     }
-    array->elements[array->count] = value;
-    array->count++;
+    STORE_SHARED(array->elements[array->count], value);
+    PUBLISH(array->count, array->count + 1);
+}
+
+size_t sizeOfObject(Obj* object) {
+    switch (object->type) {
+        case OBJ_ENTITY:   return sizeof(ObjEntity);
+        case OBJ_INSTANCE: return INSTANCE_SIZE(((ObjInstance*)object)->inlineCapacity);
+        case OBJ_FUNCTION: return sizeof(ObjFunction);
+        case OBJ_NATIVE:   return sizeof(ObjNative);
+        case OBJ_STRING:   return sizeof(ObjString) + ((ObjString*)object)->length + 1;
+        case OBJ_ARRAY:    return sizeof(ObjArray);
+#ifdef NAN_BOXING
+        case OBJ_VECTOR2:  return sizeof(ObjVector2);
+#endif
+    }
+    return 0;
 }
 
 static void printFunction(ObjFunction* function) {
@@ -151,5 +263,10 @@ void printObject(Value value){
         case OBJ_STRING:
             printf("%s", AS_CSTRING(value));
             break;
+#ifdef NAN_BOXING
+        case OBJ_VECTOR2:
+            printVector2(VECTOR2_X(value), VECTOR2_Y(value));
+            break;
+#endif
     }
 }
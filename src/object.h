@@ -5,6 +5,7 @@
 #include "value.h"
 #include "chunk.h"
 #include "table.h"
+#include "shape.h"
 
 #define OBJ_TYPE(value)     (OBJ_VALUE_TO_C(value) -> type)
 
@@ -14,6 +15,9 @@
 #define IS_NATIVE(value)        isObjType(value, OBJ_NATIVE)
 #define IS_STRING(value)        isObjType(value, OBJ_STRING)
 #define IS_ARRAY(value)    isObjType(value, OBJ_ARRAY)
+#ifdef NAN_BOXING
+#define IS_VECTOR2(value)       isObjType(value, OBJ_VECTOR2)
+#endif
 
 #define AS_ENTITY(value)        ((ObjEntity*)OBJ_VALUE_TO_C(value))
 #define AS_INSTANCE(value)      ((ObjInstance*)OBJ_VALUE_TO_C(value))
@@ -24,6 +28,13 @@
 #define AS_CSTRING(value)       (((ObjString*)OBJ_VALUE_TO_C(value))->chars)
 #define AS_ARRAY(value)    ((ObjArray*)OBJ_VALUE_TO_C(value))
 
+#ifdef NAN_BOXING
+#define AS_VECTOR2(value)       ((ObjVector2*)OBJ_VALUE_TO_C(value))
+#define VECTOR2_X(value)        (AS_VECTOR2(value)->x)
+#define VECTOR2_Y(value)        (AS_VECTOR2(value)->y)
+#define C_TO_VECTOR2_VALUE(x, y) C_TO_OBJ_VALUE(newVector2((x), (y)))
+#endif
+
 typedef enum {
     OBJ_ENTITY,
     OBJ_INSTANCE,
@@ -31,14 +42,20 @@ typedef enum {
     OBJ_NATIVE,
     OBJ_STRING,
     OBJ_ARRAY,
+#ifdef NAN_BOXING
+    OBJ_VECTOR2,
+#endif
 } ObjType;
 
+//Old objects are marked in their slab page's bitmap and found by walking
+//the pages. isForwarded is for young objects, set once the object has been
+//copied out of its space
 struct Obj {
-    bool isMarked;
+    bool isForwarded;
     bool isTenured;
     bool isQueued;
+    uint8_t age; //Minor collections survived while young
     ObjType type;
-    struct Obj* next;
 };
 
 typedef struct {
@@ -51,14 +68,24 @@ typedef struct {
 typedef struct {
     Obj obj;
     ObjString* name;
+    //Most fields any instance has grown to, new instances get this many inline
+    int inlineFields;
 } ObjEntity;
 
 typedef struct {
     Obj obj;
     ObjEntity* entity;
-    Table fields;
+    Shape* shape;
+    //Points at inlineFields until the instance outgrows them
+    Value* fields;
+    int fieldCapacity;
+    int inlineCapacity;
+    Value inlineFields[];
 } ObjInstance;
 
+#define INSTANCE_SIZE(inlineCapacity) \
+    (sizeof(ObjInstance) + sizeof(Value) * (inlineCapacity))
+
 //A fn pointer to a nativefn that returns a Value
 typedef Value (*NativeFn)(int argCount, Value* args);
 
@@ -67,11 +94,12 @@ typedef struct {
     NativeFn function;
 } ObjNative;
 
+//The characters are stored inline so a string is one block the GC can copy
 struct ObjString {
     Obj obj;
     int length;
-    char* chars;
     uint32_t hash;
+    char chars[];
 };
 
 typedef struct {
@@ -79,8 +107,21 @@ typedef struct {
     int count;
     int capacity;
     Value* elements;
+    //One byte per ARRAY_CARD_SIZE elements, set when an old array is given a
+    //young element. Only allocated once that happens
+    uint8_t* cards;
+    int cardCount;
 } ObjArray;
 
+#ifdef NAN_BOXING
+//Never changed after it is made, setting x or y makes a new one
+typedef struct {
+    Obj obj;
+    float x;
+    float y;
+} ObjVector2;
+#endif
+
 typedef struct {
     int capacity;
     int count;
@@ -89,13 +130,18 @@ typedef struct {
 
 ObjEntity* newEntity(ObjString* name);
 ObjInstance* newInstance(ObjEntity* entity);
+bool instanceGetField(ObjInstance* instance, ObjString* name, Value* value);
+void instanceSetField(ObjInstance* instance, ObjString* name, Value value);
 ObjFunction* newFunction();
 ObjNative* newNative(NativeFn function);
 ObjString* takeString(char* chars, int length);
 
 ObjArray* newArray();
+#ifdef NAN_BOXING
+ObjVector2* newVector2(float x, float y);
+#endif
 void arrayWrite(ObjArray* array, Value value);
-// size_t sizeOfObject(Obj* object);
+size_t sizeOfObject(Obj* object);
 
 void printObject(Value value);
 ObjString* copyString(const char* chars, int length);
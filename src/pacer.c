@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "memory.h"
+#include "pacer.h"
+#include "vm.h"
+
+void initPacer(Pacer* pacer) {
+    memset(&pacer->stats, 0, sizeof(PacerStats));
+    pacer->inFrame = false;
+    pacer->waitTime = 0;
+    pacer->majorCost = 0;
+    pacer->majorDeferred = false;
+    pacer->deferLimit = 0;
+    pacer->frameSwept = 0;
+}
+
+//Script time spent so far in the current frame. EndDrawing blocks on the
+//display, that is the idle time the pacer is after, so it isn't counted
+static double frameBusyTime() {
+    return secondsSince(&vm.pacer.frameStart) - vm.pacer.waitTime;
+}
+
+void pacerBeginFrame() {
+    vm.pacer.inFrame = true;
+    vm.pacer.waitTime = 0;
+    vm.pacer.frameSwept = 0;
+    clock_gettime(CLOCK_MONOTONIC, &vm.pacer.frameStart);
+}
+
+void pacerEndFrame() {
+    PacerStats* stats = &vm.pacer.stats;
+    double busy = frameBusyTime();
+    vm.pacer.inFrame = false;
+
+    stats->frames++;
+    stats->lastFrameTime = busy;
+    if (busy > stats->worstFrameTime) stats->worstFrameTime = busy;
+    if (busy > PACER_FRAME_BUDGET) stats->framesOverBudget++;
+
+    stats->lastFrameSwept = vm.pacer.frameSwept;
+    if (vm.pacer.frameSwept > stats->worstFrameSwept) {
+        stats->worstFrameSwept = vm.pacer.frameSwept;
+    }
+    stats->lastFrameUnswept = vm.sweeping ? vm.sweepEnd - vm.sweepIndex : 0;
+}
+
+void pacerBeginWait() {
+    if (vm.pacer.inFrame) clock_gettime(CLOCK_MONOTONIC, &vm.pacer.waitStart);
+}
+
+void pacerEndWait() {
+    if (vm.pacer.inFrame) vm.pacer.waitTime += secondsSince(&vm.pacer.waitStart);
+}
+
+//Runs between two draw() calls, with only the globals live. Work done here
+//is paid for by the slack the last frame left, instead of interrupting the
+//next one when an allocation happens to cross a threshold
+void pacerBetweenFrames() {
+    if (vm.isGCing) return;
+
+    PacerStats* stats = &vm.pacer.stats;
+    double slack = PACER_FRAME_BUDGET - stats->lastFrameTime;
+
+    //Sweeping here takes it off the next frame's allocations
+    if (vm.sweeping && slack > GC_SLICE_BUDGET) stepSweep();
+
+    if (vm.marking) {
+        if (slack > GC_SLICE_BUDGET) {
+            stats->idleSlices++;
+            stepMarking();
+        }
+        return;
+    }
+
+    //A major is due soon or was put off, start it while nothing is waiting
+    bool majorDue = !vm.sweeping && (vm.pacer.majorDeferred ||
+                    vm.bytesAllocatedTenure > vm.nextGCTenure / 4 * 3);
+    if (majorDue && slack > vm.pacer.majorCost) {
+        stats->idleMajors++;
+        vm.gcRequested = true;
+        vm.majorRequested = true;
+        collectRequested();
+        return;
+    }
+
+    //Emptying a half full nursery now saves a minor in the middle of the frame
+    if (vm.nurseryTop - vm.nursery > NURSERY_SIZE / 2 && slack > PACER_FRAME_BUDGET / 4) {
+        stats->idleMinors++;
+        vm.gcRequested = true;
+        vm.minorRequested = true;
+        collectRequested();
+    }
+}
+
+//Asked before a major starts. Mid frame, when the frame has less time left
+//than a major usually takes, the threshold is raised instead, up to
+//PACER_MAX_GROWTH times where it was, and the major waits for the gap
+//between frames
+bool pacerDeferMajor() {
+    Pacer* pacer = &vm.pacer;
+    if (!pacer->inFrame) return false;
+
+    if (!pacer->majorDeferred) {
+        pacer->deferLimit = vm.nextGCTenure * PACER_MAX_GROWTH;
+    }
+    if (vm.bytesAllocatedTenure >= pacer->deferLimit) {
+        if (pacer->majorDeferred) pacer->stats.forcedMajors++;
+        return false;
+    }
+    if (pacer->majorCost < PACER_FRAME_BUDGET - frameBusyTime()) return false;
+
+    size_t next = vm.bytesAllocatedTenure + vm.bytesAllocatedTenure / 4;
+    if (next > pacer->deferLimit) next = pacer->deferLimit;
+    if (next > vm.nextGCTenure) {
+        pacer->stats.grownBytes += next - vm.nextGCTenure;
+        vm.nextGCTenure = next;
+    }
+
+    pacer->majorDeferred = true;
+    pacer->stats.deferredMajors++;
+    return true;
+}
+
+//The pause a major started with, stop-the-world or the start of a mark
+void pacerRecordMajor(double seconds) {
+    Pacer* pacer = &vm.pacer;
+    pacer->majorCost = pacer->majorCost == 0 ? seconds :
+                        pacer->majorCost * 0.75 + seconds * 0.25;
+    pacer->majorDeferred = false;
+}
+
+//A major just finished marking and left this many slab pages to sweep
+void pacerDeferSweep(size_t pages) {
+    vm.pacer.stats.sweepDeferred += pages;
+}
+
+void pacerRecordSweep(size_t pages) {
+    if (vm.pacer.inFrame) {
+        vm.pacer.frameSwept += pages;
+        vm.pacer.stats.sweptInFrames += pages;
+    } else {
+        vm.pacer.stats.sweptIdle += pages;
+    }
+}
+
+PacerStats pacerStats() {
+    return vm.pacer.stats;
+}
+
+void printPacerStats() {
+    PacerStats* stats = &vm.pacer.stats;
+    printf("pacer: %zu frames, %zu over budget, worst %.3f ms\n",
+            stats->frames, stats->framesOverBudget, stats->worstFrameTime * 1000);
+    printf("pacer: idle %zu minors / %zu majors / %zu slices\n",
+            stats->idleMinors, stats->idleMajors, stats->idleSlices);
+    printf("pacer: %zu majors deferred, %zu forced, %zu bytes of growth\n",
+            stats->deferredMajors, stats->forcedMajors, stats->grownBytes);
+    printf("pacer: %zu pages swept lazily, %zu in frames (worst %zu), %zu idle\n",
+            stats->sweepDeferred, stats->sweptInFrames, stats->worstFrameSwept,
+            stats->sweptIdle);
+}
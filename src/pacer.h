@@ -0,0 +1,68 @@
+#ifndef graphiC_pacer_h
+#define graphiC_pacer_h
+
+#include <time.h>
+
+#include "common.h"
+
+//Time the script gets for one draw() call, in seconds
+#ifndef PACER_FRAME_BUDGET
+#define PACER_FRAME_BUDGET (1.0 / 60.0)
+#endif
+
+//How far the tenured heap may grow while majors are put off, as a
+//multiple of the threshold that first asked for one
+#ifndef PACER_MAX_GROWTH
+#define PACER_MAX_GROWTH 2
+#endif
+
+//What the pacer decided, for tuning it
+typedef struct {
+    size_t frames;
+    size_t framesOverBudget;
+    double lastFrameTime;  //Script time of the last frame, without EndDrawing
+    double worstFrameTime;
+
+    size_t idleMinors;     //Run between frames because the nursery was filling
+    size_t idleMajors;     //Started between frames ahead of the threshold
+    size_t idleSlices;     //Incremental mark slices run between frames
+    size_t deferredMajors; //Put off because the frame was near its deadline
+    size_t forcedMajors;   //Put off for too long and run mid frame anyway
+    size_t grownBytes;     //Threshold growth handed out instead of collecting
+
+    size_t sweepDeferred;  //Slab pages majors left to the lazy sweep
+    size_t sweptInFrames;  //Swept by allocations during draw()
+    size_t sweptIdle;      //Swept between frames or outside draw()
+    size_t lastFrameSwept;
+    size_t worstFrameSwept;
+    size_t lastFrameUnswept; //Still waiting when the last frame ended
+} PacerStats;
+
+typedef struct {
+    PacerStats stats;
+
+    bool inFrame;
+    struct timespec frameStart;
+    struct timespec waitStart;
+    double waitTime;       //Spent inside EndDrawing this frame
+
+    double majorCost;      //Running average pause of starting a major
+    bool majorDeferred;
+    size_t deferLimit;     //Tenured size at which deferring stops
+    size_t frameSwept;
+} Pacer;
+
+void initPacer(Pacer* pacer);
+void pacerBeginFrame();
+void pacerEndFrame();
+void pacerBeginWait();
+void pacerEndWait();
+void pacerBetweenFrames();
+bool pacerDeferMajor();
+void pacerRecordMajor(double seconds);
+void pacerDeferSweep(size_t pages);
+void pacerRecordSweep(size_t pages);
+PacerStats pacerStats();
+void printPacerStats();
+
+#endif
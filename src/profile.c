@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "profile.h"
+#include "vm.h"
+
+//Nothing here is built without PROFILE_ALLOCATIONS
+#ifdef PROFILE_ALLOCATIONS
+
+#define GRANULE_SHIFT 3
+
+void initAllocationProfile(AllocationProfile* profile) {
+    profile->sites = NULL;
+    profile->count = 0;
+    profile->capacity = 0;
+    profile->lookup = NULL;
+    profile->lookupCapacity = 0;
+
+    profile->nurserySites = (int*)malloc(sizeof(int) * (NURSERY_SIZE >> GRANULE_SHIFT));
+    if (profile->nurserySites == NULL) exit(1);
+    profile->arenaSites = NULL;
+    #ifdef FRAME_ARENA
+    profile->arenaSites = (int*)malloc(sizeof(int) * (FRAME_ARENA_SIZE >> GRANULE_SHIFT));
+    if (profile->arenaSites == NULL) exit(1);
+    #endif
+}
+
+void freeAllocationProfile(AllocationProfile* profile) {
+    free(profile->sites);
+    free(profile->lookup);
+    free(profile->nurserySites);
+    free(profile->arenaSites);
+    profile->sites = NULL;
+    profile->count = 0;
+    profile->capacity = 0;
+    profile->lookup = NULL;
+    profile->lookupCapacity = 0;
+    profile->nurserySites = NULL;
+    profile->arenaSites = NULL;
+}
+
+//The report needs the functions' names and line tables, so a function that
+//allocated is kept alive. Functions are allocated old and never move
+void markAllocationProfile(bool isMajor) {
+    for (int i = 0; i < vm.profile.count; i++) {
+        markObject((Obj*)vm.profile.sites[i].function, isMajor);
+    }
+}
+
+static uint32_t hashSite(ObjFunction* function, int offset, ObjType type) {
+    uint32_t hash = (uint32_t)((uintptr_t)function >> 3);
+    hash = hash * 31 + (uint32_t)offset;
+    hash = hash * 31 + (uint32_t)type;
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static void growLookup(AllocationProfile* profile) {
+    free(profile->lookup);
+    profile->lookupCapacity = profile->lookupCapacity < 64 ? 64 : profile->lookupCapacity * 2;
+    profile->lookup = (int*)calloc(profile->lookupCapacity, sizeof(int));
+    if (profile->lookup == NULL) exit(1);
+
+    int mask = profile->lookupCapacity - 1;
+    for (int i = 0; i < profile->count; i++) {
+        AllocationSite* site = &profile->sites[i];
+        uint32_t index = hashSite(site->function, site->offset, site->type) & mask;
+        while (profile->lookup[index] != 0) index = (index + 1) & mask;
+        profile->lookup[index] = i + 1;
+    }
+}
+
+static int findSite(ObjFunction* function, int offset, ObjType type) {
+    AllocationProfile* profile = &vm.profile;
+    if (profile->count + 1 > profile->lookupCapacity * 3 / 4) growLookup(profile);
+
+    int mask = profile->lookupCapacity - 1;
+    uint32_t index = hashSite(function, offset, type) & mask;
+    for (;;) {
+        int entry = profile->lookup[index];
+        if (entry == 0) break;
+
+        AllocationSite* site = &profile->sites[entry - 1];
+        if (site->function == function && site->offset == offset && site->type == type) {
+            return entry - 1;
+        }
+        index = (index + 1) & mask;
+    }
+
+    if (profile->capacity < profile->count + 1) {
+        profile->capacity = GROW_CAPACITY(profile->capacity);
+        profile->sites = (AllocationSite*)realloc(profile->sites,
+                                    sizeof(AllocationSite) * profile->capacity);
+        if (profile->sites == NULL) exit(1);
+    }
+    AllocationSite* site = &profile->sites[profile->count];
+    memset(site, 0, sizeof(AllocationSite));
+    site->function = function;
+    site->offset = offset;
+    site->type = type;
+    profile->lookup[index] = ++profile->count;
+    return profile->count - 1;
+}
+
+//Where the site of a young object that hasn't been through a minor is kept
+static int* granuleSite(Obj* object) {
+    uint8_t* address = (uint8_t*)object;
+    if (address >= vm.nursery && address < vm.nurseryEnd) {
+        return &vm.profile.nurserySites[(address - vm.nursery) >> GRANULE_SHIFT];
+    }
+    #ifdef FRAME_ARENA
+    if (isFrameObject(object)) {
+        return &vm.profile.arenaSites[(address - vm.frameArena) >> GRANULE_SHIFT];
+    }
+    #endif
+    return NULL;
+}
+
+//Every allocation stores the frame first, so the running instruction is
+//the one that asked for the object
+void profileAllocation(Obj* object, size_t size) {
+    ObjFunction* function = NULL;
+    int offset = 0;
+    if (vm.frameCount > 0) {
+        CallFrame* frame = &vm.frames[vm.frameCount - 1];
+        function = frame->function;
+        offset = (int)(frame->ip - function->chunk.code) - 1;
+        if (offset < 0) offset = 0;
+    }
+
+    int index = findSite(function, offset, object->type);
+    AllocationSite* site = &vm.profile.sites[index];
+    site->count++;
+    site->bytes += size;
+
+    int* granule = granuleSite(object);
+    if (granule != NULL) {
+        site->young++;
+        *granule = index;
+        if ((uint8_t*)object >= vm.nursery && (uint8_t*)object < vm.nurseryEnd) {
+            site->nurseryPending++;
+        } else {
+            site->arenaPending++;
+        }
+    }
+}
+
+//Called on a young object the first time a collection finds it alive
+void profileSurvivor(Obj* object) {
+    int* granule = granuleSite(object);
+    if (granule != NULL) vm.profile.sites[*granule].survived++;
+}
+
+//A collection just emptied these spaces, so everything allocated in them
+//was either copied out or left to die
+void profileYoungDecided(bool nursery, bool arena) {
+    for (int i = 0; i < vm.profile.count; i++) {
+        AllocationSite* site = &vm.profile.sites[i];
+        if (nursery) {
+            site->decided += site->nurseryPending;
+            site->nurseryPending = 0;
+        }
+        if (arena) {
+            site->decided += site->arenaPending;
+            site->arenaPending = 0;
+        }
+    }
+}
+
+static const char* typeName(ObjType type) {
+    switch (type) {
+        case OBJ_ENTITY:   return "entity";
+        case OBJ_INSTANCE: return "instance";
+        case OBJ_FUNCTION: return "function";
+        case OBJ_NATIVE:   return "native";
+        case OBJ_STRING:   return "string";
+        case OBJ_ARRAY:    return "array";
+#ifdef NAN_BOXING
+        case OBJ_VECTOR2:  return "Vector2";
+#endif
+    }
+    return "?";
+}
+
+static int compareSites(const void* a, const void* b) {
+    const AllocationSite* left = *(const AllocationSite* const*)a;
+    const AllocationSite* right = *(const AllocationSite* const*)b;
+    if (left->bytes != right->bytes) return left->bytes < right->bytes ? 1 : -1;
+    if (left->count != right->count) return left->count < right->count ? 1 : -1;
+    return 0;
+}
+
+//Heaviest sites first. Only the objects themselves are counted, not the
+//element and field buffers they grow
+void printAllocationProfile() {
+    AllocationProfile* profile = &vm.profile;
+    if (profile->count == 0) return;
+
+    AllocationSite** order = (AllocationSite**)malloc(sizeof(AllocationSite*) * profile->count);
+    if (order == NULL) exit(1);
+    for (int i = 0; i < profile->count; i++) order[i] = &profile->sites[i];
+    qsort(order, profile->count, sizeof(AllocationSite*), compareSites);
+
+    //Objects still young have not been found alive or dead yet, they are
+    //counted apart instead of as dead
+    printf("allocations: %12s %10s %9s %9s  %-8s %5s %6s  %s\n",
+            "bytes", "count", "survived", "pending", "type", "line", "offset", "function");
+    for (int i = 0; i < profile->count; i++) {
+        AllocationSite* site = order[i];
+
+        char survived[16] = "-";
+        if (site->decided > 0) {
+            snprintf(survived, sizeof(survived), "%.1f%%",
+                    100.0 * site->survived / site->decided);
+        }
+        size_t pending = site->nurseryPending + site->arenaPending;
+
+        if (site->function == NULL) {
+            printf("allocations: %12zu %10zu %9s %9zu  %-8s %5s %6s  <vm>\n",
+                    site->bytes, site->count, survived, pending, typeName(site->type),
+                    "-", "-");
+            continue;
+        }
+        printf("allocations: %12zu %10zu %9s %9zu  %-8s %5d %6d  %s\n",
+                site->bytes, site->count, survived, pending, typeName(site->type),
+                site->function->chunk.lines[site->offset], site->offset,
+                site->function->name != NULL ? site->function->name->chars : "<script>");
+    }
+    free(order);
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef graphiC_profile_h
+#define graphiC_profile_h
+
+#include "common.h"
+#include "object.h"
+
+//Every object of one type allocated by one instruction
+typedef struct {
+    ObjFunction* function; //NULL when no call was running, e.g. while compiling
+    int offset;            //Same instruction offset runtime errors report
+    ObjType type;
+    size_t count;
+    size_t bytes;
+    size_t young;          //Of count, allocated in the nursery or frame arena
+    size_t decided;        //Of young, through the collection that emptied their space
+    size_t survived;       //Of decided, still alive at it
+    //Of young, still in the nursery or the arena waiting for that collection
+    size_t nurseryPending;
+    size_t arenaPending;
+} AllocationSite;
+
+typedef struct {
+    AllocationSite* sites;
+    int count;
+    int capacity;
+    //Open addressed, holds a site index + 1, 0 for an empty slot
+    int* lookup;
+    int lookupCapacity;
+    //Site of the young object starting at each 8 byte granule, so the
+    //minor can find where a survivor came from
+    int* nurserySites;
+    int* arenaSites;
+} AllocationProfile;
+
+void initAllocationProfile(AllocationProfile* profile);
+void freeAllocationProfile(AllocationProfile* profile);
+void markAllocationProfile(bool isMajor);
+void profileAllocation(Obj* object, size_t size);
+void profileSurvivor(Obj* object);
+void profileYoungDecided(bool nursery, bool arena);
+void printAllocationProfile();
+
+#endif
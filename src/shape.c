@@ -0,0 +1,88 @@
+#include <string.h>
+
+#include "memory.h"
+#include "shape.h"
+#include "vm.h"
+
+static Shape* allocateShape(int fieldCount) {
+    Shape* shape = ALLOCATE(Shape, 1);
+    shape->fieldCount = fieldCount;
+    shape->keys = NULL;
+    shape->transitions = NULL;
+    shape->transitionCount = 0;
+    shape->transitionCapacity = 0;
+    shape->next = NULL;
+    return shape;
+}
+
+static void linkShape(Shape* shape) {
+    shape->next = vm.shapes;
+    vm.shapes = shape;
+}
+
+Shape* newRootShape() {
+    Shape* shape = allocateShape(0);
+    linkShape(shape);
+    return shape;
+}
+
+int shapeFieldIndex(Shape* shape, ObjString* name) {
+    //Names are interned so a pointer compare is enough
+    for (int i = shape->fieldCount - 1; i >= 0; i--) {
+        if (shape->keys[i] == name) return i;
+    }
+    return -1;
+}
+
+//Returns the shape you get by appending name to shape, reusing the
+//transition if another instance already took the same path
+Shape* shapeAddField(Shape* shape, ObjString* name) {
+    for (int i = 0; i < shape->transitionCount; i++) {
+        Shape* transition = shape->transitions[i];
+        if (transition->keys[transition->fieldCount - 1] == name) {
+            return transition;
+        }
+    }
+
+    //Nothing here is reachable from the shape list until linkShape, so a
+    //collection in the middle of this sees the old state only
+    Shape* child = allocateShape(shape->fieldCount + 1);
+    child->keys = ALLOCATE(ObjString*, child->fieldCount);
+    if (shape->fieldCount > 0) {
+        memcpy(child->keys, shape->keys, sizeof(ObjString*) * shape->fieldCount);
+    }
+    child->keys[shape->fieldCount] = name;
+
+    if (shape->transitionCapacity < shape->transitionCount + 1) {
+        int oldCapacity = shape->transitionCapacity;
+        shape->transitionCapacity = GROW_CAPACITY(oldCapacity);
+        shape->transitions = GROW_ARRAY(Shape*, shape->transitions,
+                                        oldCapacity, shape->transitionCapacity);
+    }
+    shape->transitions[shape->transitionCount++] = child;
+    linkShape(child);
+    return child;
+}
+
+void markShapes(bool isMajor) {
+    //Keys are copied into every descendant shape, and the string may move,
+    //so each copy has to be updated
+    for (Shape* shape = vm.shapes; shape != NULL; shape = shape->next) {
+        for (int i = 0; i < shape->fieldCount; i++) {
+            MARK_OBJECT(shape->keys[i], isMajor);
+        }
+    }
+}
+
+void freeShapes() {
+    Shape* shape = vm.shapes;
+    while (shape != NULL) {
+        Shape* next = shape->next;
+        FREE_ARRAY(ObjString*, shape->keys, shape->fieldCount);
+        FREE_ARRAY(Shape*, shape->transitions, shape->transitionCapacity);
+        FREE(Shape, shape);
+        shape = next;
+    }
+    vm.shapes = NULL;
+    vm.rootShape = NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef graphiC_shape_h
+#define graphiC_shape_h
+
+#include "common.h"
+#include "value.h"
+
+//A shape is the layout shared by every instance that got the same fields
+//in the same order. Shapes are never collected, there are only as many as
+//there are distinct field orders in a script
+typedef struct Shape {
+    int fieldCount;
+    ObjString** keys; //Field name for every slot, in slot order
+
+    struct Shape** transitions;
+    int transitionCount;
+    int transitionCapacity;
+
+    struct Shape* next; //Every shape the VM has made, for marking and freeing
+} Shape;
+
+Shape* newRootShape();
+int shapeFieldIndex(Shape* shape, ObjString* name);
+Shape* shapeAddField(Shape* shape, ObjString* name);
+void markShapes(bool isMajor);
+void freeShapes();
+
+#endif
@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "slab.h"
+#include "vm.h"
+
+static const int cellSizes[SLAB_CLASS_COUNT] = {
+    16, 24, 32, 48, 64, 80, 96, 128, 160, 192, 256,
+    320, 384, 512, 768, 1024, 1536, 2048
+};
+
+//Size class for every multiple of 8 up to SLAB_MAX_CELL
+static uint8_t classForSize[SLAB_MAX_CELL / 8 + 1];
+
+//Cells start after the header, kept 16 byte aligned
+#define PAGE_HEADER ((sizeof(SlabPage) + 15) & ~(size_t)15)
+
+//Pages are aligned to SLAB_PAGE_SIZE so a cell can find its page
+static SlabPage* allocatePage(size_t size) {
+    #ifdef _WIN32
+    SlabPage* page = (SlabPage*)_aligned_malloc(size, SLAB_PAGE_SIZE);
+    #else
+    SlabPage* page = (SlabPage*)aligned_alloc(SLAB_PAGE_SIZE, size);
+    #endif
+    if (page == NULL) exit(1);
+
+    memset(page->marks, 0, SLAB_MARK_BYTES);
+    memset(page->allocated, 0, SLAB_MARK_BYTES);
+    page->prev = NULL;
+    page->next = NULL;
+
+    if (vm.slabPageCapacity < vm.slabPageCount + 1) {
+        vm.slabPageCapacity = vm.slabPageCapacity < 8 ? 8 : vm.slabPageCapacity * 2;
+        vm.slabPages = (SlabPage**)realloc(vm.slabPages,
+                                    sizeof(SlabPage*) * vm.slabPageCapacity);
+        if (vm.slabPages == NULL) exit(1);
+    }
+    page->index = vm.slabPageCount;
+    vm.slabPages[vm.slabPageCount++] = page;
+    return page;
+}
+
+static void releasePage(SlabPage* page) {
+    if (page->sizeClass != SLAB_LARGE) vm.slabs[page->sizeClass].pageCount--;
+
+    SlabPage* last = vm.slabPages[--vm.slabPageCount];
+    vm.slabPages[page->index] = last;
+    last->index = page->index;
+
+    #ifdef _WIN32
+    _aligned_free(page);
+    #else
+    free(page);
+    #endif
+}
+
+void initSlabs() {
+    int sizeClass = 0;
+    for (int i = 0; i <= SLAB_MAX_CELL / 8; i++) {
+        while (cellSizes[sizeClass] < i * 8) sizeClass++;
+        classForSize[i] = (uint8_t)sizeClass;
+    }
+
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+        vm.slabs[i].cellSize = cellSizes[i];
+        vm.slabs[i].available = NULL;
+        vm.slabs[i].pageCount = 0;
+    }
+    vm.slabPages = NULL;
+    vm.slabPageCount = 0;
+    vm.slabPageCapacity = 0;
+}
+
+static void setAllocated(void* cell) {
+    int granule = slabGranule(cell);
+    slabPageOf(cell)->allocated[granule >> 3] |= (uint8_t)(1 << (granule & 7));
+}
+
+static void unlinkPage(SlabClass* slab, SlabPage* page) {
+    if (page->prev != NULL) page->prev->next = page->next;
+    else slab->available = page->next;
+    if (page->next != NULL) page->next->prev = page->prev;
+    page->prev = NULL;
+    page->next = NULL;
+}
+
+static void linkPage(SlabClass* slab, SlabPage* page) {
+    page->prev = NULL;
+    page->next = slab->available;
+    if (slab->available != NULL) slab->available->prev = page;
+    slab->available = page;
+}
+
+static SlabPage* newPage(int sizeClass) {
+    SlabClass* slab = &vm.slabs[sizeClass];
+    SlabPage* page = allocatePage(SLAB_PAGE_SIZE);
+    page->sizeClass = sizeClass;
+    page->cellCount = (int)((SLAB_PAGE_SIZE - PAGE_HEADER) / slab->cellSize);
+    page->freeCount = page->cellCount;
+
+    //Thread the free list through the cells, lowest address first
+    uint8_t* cells = (uint8_t*)page + PAGE_HEADER;
+    page->freeList = NULL;
+    for (int i = page->cellCount - 1; i >= 0; i--) {
+        void** cell = (void**)(cells + (size_t)i * slab->cellSize);
+        *cell = page->freeList;
+        page->freeList = cell;
+    }
+
+    slab->pageCount++;
+    linkPage(slab, page);
+    return page;
+}
+
+//A page of its own, rounded up to whole pages. The object starts inside
+//the first one, so masking its address still finds the header
+static void* allocateLarge(size_t size) {
+    size_t pageSize = (PAGE_HEADER + size + SLAB_PAGE_SIZE - 1) &
+                        ~(size_t)(SLAB_PAGE_SIZE - 1);
+    SlabPage* page = allocatePage(pageSize);
+    page->sizeClass = SLAB_LARGE;
+    page->cellCount = 1;
+    page->freeCount = 0;
+    page->freeList = NULL;
+
+    void* cell = (uint8_t*)page + PAGE_HEADER;
+    setAllocated(cell);
+    return cell;
+}
+
+void* slabAllocate(size_t size) {
+    if (size > SLAB_MAX_CELL) return allocateLarge(size);
+
+    int sizeClass = classForSize[(size + 7) / 8];
+    SlabClass* slab = &vm.slabs[sizeClass];
+
+    SlabPage* page = slab->available;
+    if (page == NULL) page = newPage(sizeClass);
+
+    void** cell = (void**)page->freeList;
+    page->freeList = *cell;
+    page->freeCount--;
+    //Full pages leave the list until a cell comes back
+    if (page->freeCount == 0) unlinkPage(slab, page);
+    setAllocated(cell);
+    return cell;
+}
+
+//Frees every allocated cell on the page whose mark bit is clear. Reads the
+//two bitmaps a byte at a time, the live objects themselves are never
+//touched. Returns true if the page ended up empty and was released
+bool slabSweep(SlabPage* page, SlabFinalizer finalize) {
+    int freed = 0;
+    for (int i = 0; i < SLAB_MARK_BYTES; i++) {
+        uint8_t dead = page->allocated[i] & ~page->marks[i];
+        if (dead == 0) continue;
+        page->allocated[i] &= ~dead;
+
+        for (int bit = 0; bit < 8; bit++) {
+            if (!(dead & (1 << bit))) continue;
+            void* cell = (uint8_t*)page + ((size_t)(i * 8 + bit) << SLAB_GRANULE_SHIFT);
+            finalize(cell);
+            *(void**)cell = page->freeList;
+            page->freeList = cell;
+            freed++;
+        }
+    }
+    if (freed == 0) return false;
+
+    if (page->sizeClass == SLAB_LARGE) {
+        releasePage(page);
+        return true;
+    }
+
+    SlabClass* slab = &vm.slabs[page->sizeClass];
+    if (page->freeCount == 0) linkPage(slab, page);
+    page->freeCount += freed;
+
+    //An empty page goes back to the system, unless it's the last one with
+    //room, which would only be allocated again on the next promotion
+    if (page->freeCount == page->cellCount &&
+        (page->prev != NULL || page->next != NULL)) {
+        unlinkPage(slab, page);
+        releasePage(page);
+        return true;
+    }
+    return false;
+}
+
+//Starts a mark without writing to a single object
+void slabClearMarks() {
+    for (int i = 0; i < vm.slabPageCount; i++) {
+        memset(vm.slabPages[i]->marks, 0, SLAB_MARK_BYTES);
+    }
+}
+
+//Every object has been swept by now, only empty pages are left
+void freeSlabs() {
+    while (vm.slabPageCount > 0) {
+        releasePage(vm.slabPages[vm.slabPageCount - 1]);
+    }
+    free(vm.slabPages);
+    vm.slabPages = NULL;
+    vm.slabPageCapacity = 0;
+
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+        vm.slabs[i].available = NULL;
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef graphiC_slab_h
+#define graphiC_slab_h
+
+#include <stdint.h>
+
+#include "common.h"
+
+//Every old object is cut from a page aligned to SLAB_PAGE_SIZE, so its page
+//and its mark bit are found from the address alone. Objects up to
+//SLAB_MAX_CELL share pages of equal sized cells, bigger ones get a page to
+//themselves. The pages are the old generation, there is no object list
+//besides them
+#define SLAB_PAGE_SIZE (16 * 1024)
+#define SLAB_MAX_CELL 2048
+#define SLAB_CLASS_COUNT 18
+#define SLAB_LARGE (-1)
+
+//One mark bit and one allocated bit for every 16 bytes of page. Cells are
+//at least that big, so no two of them start in the same granule
+#define SLAB_GRANULE_SHIFT 4
+#define SLAB_MARK_BYTES (SLAB_PAGE_SIZE >> SLAB_GRANULE_SHIFT >> 3)
+
+typedef struct SlabPage {
+    struct SlabPage* prev;
+    struct SlabPage* next;
+    void* freeList;
+    int freeCount;
+    int cellCount;
+    int sizeClass;
+    int index; //Slot in vm.slabPages
+    uint8_t marks[SLAB_MARK_BYTES];
+    uint8_t allocated[SLAB_MARK_BYTES];
+} SlabPage;
+
+//Called on every cell a sweep is about to free
+typedef void (*SlabFinalizer)(void* cell);
+
+typedef struct {
+    int cellSize;
+    SlabPage* available; //Pages with at least one free cell
+    size_t pageCount;
+} SlabClass;
+
+void initSlabs();
+void* slabAllocate(size_t size);
+bool slabSweep(SlabPage* page, SlabFinalizer finalize);
+void slabClearMarks();
+void freeSlabs();
+
+static inline SlabPage* slabPageOf(const void* cell) {
+    return (SlabPage*)((uintptr_t)cell & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+}
+
+static inline int slabGranule(const void* cell) {
+    return (int)(((uintptr_t)cell & (SLAB_PAGE_SIZE - 1)) >> SLAB_GRANULE_SHIFT);
+}
+
+//Mark threads set bits in the same bytes as each other and as the VM
+//allocating black, so with either of them every access is atomic
+#if defined(CONCURRENT_MARK) || defined(PARALLEL_MARK)
+#define SLAB_ATOMIC_MARKS
+#endif
+
+static inline bool slabIsMarked(const void* cell) {
+    int granule = slabGranule(cell);
+    uint8_t* byte = &slabPageOf(cell)->marks[granule >> 3];
+    #ifdef SLAB_ATOMIC_MARKS
+    return (__atomic_load_n(byte, __ATOMIC_ACQUIRE) >> (granule & 7)) & 1;
+    #else
+    return (*byte >> (granule & 7)) & 1;
+    #endif
+}
+
+//Returns true if the cell wasn't marked before
+static inline bool slabSetMark(void* cell) {
+    int granule = slabGranule(cell);
+    uint8_t* byte = &slabPageOf(cell)->marks[granule >> 3];
+    uint8_t bit = (uint8_t)(1 << (granule & 7));
+    #ifdef SLAB_ATOMIC_MARKS
+    return !(__atomic_fetch_or(byte, bit, __ATOMIC_ACQ_REL) & bit);
+    #else
+    if (*byte & bit) return false;
+    *byte |= bit;
+    return true;
+    #endif
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include "memory.h"
 #include "object.h"
 #include "table.h"
+#include "slab.h"
 
 
 #define TABLE_MAX_LOAD 0.75
@@ -142,10 +143,19 @@ ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t
 void tableRemoveWhite(Table* table, bool isMajor) {
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
-        if(entry->key != NULL && !isMajor && entry->key->obj.isTenured){
-            continue;
+        if (entry->key == NULL) continue;
+
+        if (!isMajor) {
+            //Only nursery strings can die in a minor, the survivors moved
+            if (entry->key->obj.isTenured) continue;
+            ObjString* moved = (ObjString*)forwardingAddress((Obj*)entry->key);
+            if (moved != NULL) {
+                entry->key = moved;
+            } else {
+                tableDelete(table, entry->key);
+            }
         }
-        if (entry->key != NULL && !entry->key->obj.isMarked) {
+        else if (!slabIsMarked(entry->key)) {
             tableDelete(table, entry->key);
         }
     }
@@ -155,8 +165,8 @@ void tableRemoveWhite(Table* table, bool isMajor) {
 void markTable(Table* table, bool isMajor) {
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
-        markObject((Obj*)entry->key, isMajor);
-        markValue(entry->value, isMajor);
+        MARK_OBJECT(entry->key, isMajor);
+        entry->value = markValue(entry->value, isMajor);
     }
 }
 
@@ -27,7 +27,33 @@ void freeValueArray(ValueArray* array){
     initValueArray(array);
 }
 
+void printVector2(float x, float y){
+    printf("Vector2(%g, %g)", x, y);
+}
+
+void printColor(uint32_t rgba){
+    printf("Color(%d, %d, %d, %d)", COLOR_CHANNEL(rgba, 0), COLOR_CHANNEL(rgba, 1),
+           COLOR_CHANNEL(rgba, 2), COLOR_CHANNEL(rgba, 3));
+}
+
 void printValue(Value value){
+#ifdef NAN_BOXING
+    if (IS_BOOL(value)) {
+        printf(BOOL_VALUE_TO_C(value) ? "true" : "false");
+    }
+    else if (IS_NULL(value)) {
+        printf("null");
+    }
+    else if (IS_NUMBER(value)) {
+        printf("%g", NUMBER_VALUE_TO_C(value));
+    }
+    else if (IS_COLOR(value)) {
+        printColor(COLOR_VALUE_TO_C(value));
+    }
+    else if (IS_OBJ(value)) {
+        printObject(value);
+    }
+#else
     switch(value.type) {
         case VAL_BOOL:
             printf(BOOL_VALUE_TO_C(value) ? "true" : "false");
@@ -35,17 +61,37 @@ void printValue(Value value){
         case VAL_NULL: printf("null"); break;
         case VAL_NUMBER: printf("%g", NUMBER_VALUE_TO_C(value)); break;
         case VAL_OBJ: printObject(value); break;
+        case VAL_VECTOR2: printVector2(VECTOR2_X(value), VECTOR2_Y(value)); break;
+        case VAL_COLOR: printColor(COLOR_VALUE_TO_C(value)); break;
+        case VAL_EMPTY: break;
     }
+#endif
 }
 
 bool valuesEqual(Value a, Value b) {
+#ifdef NAN_BOXING
+    //Keep IEEE semantics so NaN != NaN
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        return NUMBER_VALUE_TO_C(a) == NUMBER_VALUE_TO_C(b);
+    }
+    //Boxed vectors still compare by value
+    if (IS_VECTOR2(a) && IS_VECTOR2(b)) {
+        return VECTOR2_X(a) == VECTOR2_X(b) && VECTOR2_Y(a) == VECTOR2_Y(b);
+    }
+    return a == b;
+#else
     if (a.type != b.type) return false;
 
     switch (a.type) {
         case VAL_BOOL: return BOOL_VALUE_TO_C(a) == BOOL_VALUE_TO_C(b);
         case VAL_NULL: return true; // Both are null
+        case VAL_EMPTY: return true;
         case VAL_NUMBER: return NUMBER_VALUE_TO_C(a) == NUMBER_VALUE_TO_C(b);
         case VAL_OBJ: return OBJ_VALUE_TO_C(a) == OBJ_VALUE_TO_C(b);
+        case VAL_VECTOR2:
+            return VECTOR2_X(a) == VECTOR2_X(b) && VECTOR2_Y(a) == VECTOR2_Y(b);
+        case VAL_COLOR: return COLOR_VALUE_TO_C(a) == COLOR_VALUE_TO_C(b);
         default: return false; // Unreachable, but keeps the compiler happy.
     }
+#endif
 }
\ No newline at end of file
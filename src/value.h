@@ -6,11 +6,79 @@
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 
+#ifdef NAN_BOXING
+
+/*
+A Value is a single 64 bit word. Anything that is not a quiet NaN is a double,
+the rest is tagged inside the unused NaN bits:
+    [sign][ quiet NaN bits ][ payload ]
+    Objects set the sign bit and keep the pointer in the low 48 bits
+    Singletons (null, true, false) use the low 2 bits as a tag
+    Colors set bit 48 and keep their packed RGBA in the low 32 bits
+A Vector2 is two floats and does not fit next to a tag, so with NaN boxing 
+it is a small immutable object instead (see ObjVector2)
+*/
+#include <string.h>
+
+#define SIGN_BIT    ((uint64_t)0x8000000000000000)
+#define QNAN        ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NULL    1 // 01
+#define TAG_FALSE   2 // 10
+#define TAG_TRUE    3 // 11
+#define TAG_EMPTY   4 //100
+#define COLOR_BIT   ((uint64_t)0x0001000000000000)
+
+typedef uint64_t Value;
+
+#define FALSE_VAL   ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL    ((Value)(uint64_t)(QNAN | TAG_TRUE))
+
+//CHECK THE TYPE OF A VALUE
+#define IS_BOOL(value)      (((value) | 1) == TRUE_VAL)
+#define IS_NULL(value)      ((value) == C_TO_NULL_VALUE)
+#define IS_EMPTY(value)     ((value) == C_TO_EMPTY_VALUE)
+#define IS_NUMBER(value)    (((value) & QNAN) != QNAN)
+#define IS_OBJ(value)       (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_COLOR(value)     (((value) & (SIGN_BIT | QNAN | COLOR_BIT)) == (QNAN | COLOR_BIT))
+
+//RETURN THE RAW C VALUE GIVEN THE VALUE
+#define BOOL_VALUE_TO_C(value)   ((value) == TRUE_VAL)
+#define NUMBER_VALUE_TO_C(value) valueToNum(value)
+#define OBJ_VALUE_TO_C(value)    ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+#define COLOR_VALUE_TO_C(value)  ((uint32_t)(value))
+
+//GIVEN RAW C VALUE, ENTER IT INTO THE RELEVANT TYPE 
+#define C_TO_BOOL_VALUE(b)       ((b) ? TRUE_VAL : FALSE_VAL)
+#define C_TO_NULL_VALUE          ((Value)(uint64_t)(QNAN | TAG_NULL))
+#define C_TO_EMPTY_VALUE         ((Value)(uint64_t)(QNAN | TAG_EMPTY))
+#define C_TO_NUMBER_VALUE(num)   numToValue(num)
+#define C_TO_OBJ_VALUE(obj)      (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+#define C_TO_COLOR_VALUE(rgba)   ((Value)(QNAN | COLOR_BIT | (uint64_t)(uint32_t)(rgba)))
+
+//memcpy is the type pun the compiler is allowed to see through
+static inline double valueToNum(Value value) {
+    double num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+
+static inline Value numToValue(double num) {
+    Value value;
+    memcpy(&value, &num, sizeof(double));
+    return value;
+}
+
+#else
+
 typedef enum {
     VAL_BOOL,
     VAL_NULL,
     VAL_NUMBER,
     VAL_OBJ,
+    VAL_VECTOR2,
+    VAL_COLOR,
+    VAL_EMPTY, //Never visible to scripts, marks a global slot with no definition yet
 } ValueType;
 
 typedef struct Value {
@@ -19,39 +87,58 @@ typedef struct Value {
         bool boolean;
         double number;
         Obj* obj;
+        struct { float x; float y; } vector2;
+        uint32_t color;
     } as;
 } Value;
 
-typedef struct 
-{
-    int capacity;
-    int count;
-    Value* values;
-} ValueArray;
-
 //CHECK THE TYPE OF A VALUE
 #define IS_BOOL(value)      ((value).type == VAL_BOOL)
 #define IS_NULL(value)       ((value).type == VAL_NULL)
+#define IS_EMPTY(value)     ((value).type == VAL_EMPTY)
 #define IS_NUMBER(value)    ((value).type == VAL_NUMBER)
 #define IS_OBJ(value)       ((value).type == VAL_OBJ)
+#define IS_VECTOR2(value)   ((value).type == VAL_VECTOR2)
+#define IS_COLOR(value)     ((value).type == VAL_COLOR)
 
 //RETURN THE RAW C VALUE GIVEN THE VALUE
 #define BOOL_VALUE_TO_C(value)   ((value).as.boolean)
 #define NUMBER_VALUE_TO_C(value) ((value).as.number)
 #define OBJ_VALUE_TO_C(value)    ((value).as.obj)
+#define VECTOR2_X(value)         ((value).as.vector2.x)
+#define VECTOR2_Y(value)         ((value).as.vector2.y)
+#define COLOR_VALUE_TO_C(value)  ((value).as.color)
 
 //GIVEN RAW C VALUE, ENTER IT INTO THE RELEVANT TYPE 
 #define C_TO_BOOL_VALUE(value) ((Value){VAL_BOOL, {.boolean = value}})
 #define C_TO_NULL_VALUE ((Value){VAL_NULL, {.number = 0}})
+#define C_TO_EMPTY_VALUE ((Value){VAL_EMPTY, {.number = 0}})
 #define C_TO_NUMBER_VALUE(value) ((Value){VAL_NUMBER, {.number = value}})
 #define C_TO_OBJ_VALUE(object)      ((Value){VAL_OBJ, {.obj = (Obj*)object}})
+#define C_TO_VECTOR2_VALUE(x, y) ((Value){VAL_VECTOR2, {.vector2 = {(x), (y)}}})
+#define C_TO_COLOR_VALUE(rgba) ((Value){VAL_COLOR, {.color = (rgba)}})
+
+#endif
 
+//Colors are packed as 0xAABBGGRR
+#define PACK_COLOR(r, g, b, a) \
+    ((uint32_t)(r) | ((uint32_t)(g) << 8) | ((uint32_t)(b) << 16) | ((uint32_t)(a) << 24))
+#define COLOR_CHANNEL(rgba, channel) ((uint8_t)((rgba) >> ((channel) * 8)))
+
+typedef struct 
+{
+    int capacity;
+    int count;
+    Value* values;
+} ValueArray;
 
 bool valuesEqual(Value a, Value b);
 void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
 void freeValueArray(ValueArray* array);
 void printValue(Value value);
+void printVector2(float x, float y);
+void printColor(uint32_t rgba);
 
 
 
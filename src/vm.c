@@ -5,7 +5,9 @@
 #include "object.h"
 #include "memory.h"
 #include "compiler.h"
+#include "heapdump.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include <time.h>
@@ -17,6 +19,64 @@ static Value clockNative(int argCount, Value* args) {
     return C_TO_NUMBER_VALUE((double)clock() / CLOCKS_PER_SEC);
 }
 
+static void setStat(ObjInstance* stats, const char* name, double value) {
+    ObjString* key = copyString(name, (int)strlen(name));
+    push(C_TO_OBJ_VALUE(key));
+    instanceSetField(stats, key, C_TO_NUMBER_VALUE(value));
+    pop();
+}
+
+//A fresh instance with the collector's and the pacer's numbers so far. Times
+//are in milliseconds
+static Value gcStatsNative(int argCount, Value* args) {
+    GCLog* log = &vm.gcLog;
+    double lastPause = 0;
+    if (log->count > 0) {
+        GCEvent* last = &log->events[(log->count - 1) % GC_LOG_SIZE];
+        lastPause = last->end - last->start;
+    }
+
+    ObjInstance* stats = newInstance(vm.gcStatsEntity);
+    push(C_TO_OBJ_VALUE(stats));
+    setStat(stats, "minors", log->kindCounts[GC_EVENT_MINOR]);
+    setStat(stats, "majors", log->kindCounts[GC_EVENT_MAJOR]);
+    setStat(stats, "lastPause", lastPause * 1000);
+    setStat(stats, "worstPause", log->worstPause * 1000);
+    setStat(stats, "totalPause", log->totalPause * 1000);
+    setStat(stats, "youngBytes", vm.bytesAllocated);
+    setStat(stats, "oldBytes", vm.bytesAllocatedTenure);
+    setStat(stats, "promotedBytes", log->promoted);
+    setStat(stats, "remSet", vm.remSet.count);
+    setStat(stats, "events", log->count);
+    setStat(stats, "allocations", log->allocations);
+
+    //What the pacer did with the time between frames
+    PacerStats pacer = pacerStats();
+    setStat(stats, "frames", pacer.frames);
+    setStat(stats, "framesOverBudget", pacer.framesOverBudget);
+    setStat(stats, "worstFrameTime", pacer.worstFrameTime * 1000);
+    setStat(stats, "idleMinors", pacer.idleMinors);
+    setStat(stats, "idleMajors", pacer.idleMajors);
+    setStat(stats, "idleSlices", pacer.idleSlices);
+    setStat(stats, "deferredMajors", pacer.deferredMajors);
+    setStat(stats, "forcedMajors", pacer.forcedMajors);
+    setStat(stats, "sweptInFrames", pacer.sweptInFrames);
+    return pop();
+}
+
+//heapDump(path) writes the live heap for analyzeHeapDump, true if it could
+static Value heapDumpNative(int argCount, Value* args) {
+    if (argCount != 1 || !IS_STRING(args[0])) return C_TO_BOOL_VALUE(false);
+    return C_TO_BOOL_VALUE(writeHeapDump(AS_CSTRING(args[0])));
+}
+
+#ifdef PROFILE_ALLOCATIONS
+static Value allocationReportNative(int argCount, Value* args) {
+    printAllocationProfile();
+    return C_TO_NULL_VALUE;
+}
+#endif
+
 static void resetStack() {
     vm.stackTop = vm.stack;
     vm.frameCount = 0;
@@ -49,10 +109,37 @@ static void runtimeError(const char* format, ...){
     resetStack();
 }
 
+//Hands out the slot for a global name, creating an undefined one the first
+//time the name is seen. Called by the compiler for every global reference
+int globalSlot(ObjString* name) {
+    Value slot;
+    if (tableGet(&vm.globalNames, name, &slot)) {
+        return (int)NUMBER_VALUE_TO_C(slot);
+    }
+
+    push(C_TO_OBJ_VALUE(name));
+    int index = vm.globalValues.count;
+    writeValueArray(&vm.globalValues, C_TO_EMPTY_VALUE);
+    writeValueArray(&vm.globalIdentifiers, C_TO_OBJ_VALUE(name));
+    tableSet(&vm.globalNames, name, C_TO_NUMBER_VALUE((double)index));
+    pop();
+    return index;
+}
+
+//Name based lookup, only for code outside of compiled bytecode
+bool getGlobal(ObjString* name, Value* value) {
+    Value slot;
+    if (!tableGet(&vm.globalNames, name, &slot)) return false;
+
+    *value = vm.globalValues.values[(int)NUMBER_VALUE_TO_C(slot)];
+    return !IS_EMPTY(*value);
+}
+
 static void defineNative(const char* name, NativeFn function) {
     push(C_TO_OBJ_VALUE(copyString(name, (int)strlen(name))));
     push(C_TO_OBJ_VALUE(newNative(function)));
-    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    int slot = globalSlot(AS_STRING(vm.stack[0]));
+    vm.globalValues.values[slot] = vm.stack[1];
     pop();
     pop();
 }
@@ -83,22 +170,100 @@ static void defineRaylibNatives() {
 void initVM() {
     resetStack();
 
-    vm.objects = NULL;
-
+    vm.sweeping = false;
+    vm.sweepIndex = 0;
+    vm.sweepEnd = 0;
+    vm.tenureUnjudged = 0;
+    #ifdef NAN_BOXING
+    for (int i = 0; i < STACK_MAX; i++) {
+        Obj* cell = &vm.scratchVectors[i].obj;
+        cell->type = OBJ_VECTOR2;
+        cell->isTenured = false;
+        cell->isForwarded = false;
+        cell->isQueued = false;
+        cell->age = 0;
+    }
+    vm.scratchTarget = NULL;
+    #endif
+    vm.shapes = NULL;
+    vm.rootShape = newRootShape();
+    initSlabs();
+
+    vm.nursery = (uint8_t*)malloc(NURSERY_SIZE);
+    if (vm.nursery == NULL) exit(1);
+    vm.nurseryTop = vm.nursery;
+    vm.nurseryEnd = vm.nursery + NURSERY_SIZE;
+    vm.survivorFrom = (uint8_t*)malloc(SURVIVOR_SIZE);
+    vm.survivorTo = (uint8_t*)malloc(SURVIVOR_SIZE);
+    if (vm.survivorFrom == NULL || vm.survivorTo == NULL) exit(1);
+    vm.survivorTop = vm.survivorFrom;
+    vm.survivorEnd = vm.survivorFrom + SURVIVOR_SIZE;
+    vm.promoteAll = false;
     vm.bytesAllocated = 0;
-    vm.nextGC = vm.nextGCTenure = 1024 * 1024;
+
+    #ifdef FRAME_ARENA
+    vm.frameArena = (uint8_t*)malloc(FRAME_ARENA_SIZE);
+    if (vm.frameArena == NULL) exit(1);
+    vm.frameArenaTop = vm.frameArena;
+    vm.frameArenaEnd = vm.frameArena + FRAME_ARENA_SIZE;
+    vm.frameArenaActive = false;
+    vm.frameOverflowed = false;
+    vm.frameStrings = false;
+    vm.evacuatingFrame = false;
+    vm.frameEscapes = NULL;
+    vm.frameEscapeCount = 0;
+    vm.frameEscapeCapacity = 0;
+    #endif
+
+    vm.youngBuffers = NULL;
+    vm.youngBufferCount = 0;
+    vm.youngBufferCapacity = 0;
+
+    #ifdef PROFILE_ALLOCATIONS
+    initAllocationProfile(&vm.profile);
+    #endif
+
+    vm.nextGCTenure = 1024 * 1024;
     vm.isGCing = false;
+    vm.remSet.objects = NULL;
+    vm.remSet.count = 0;
+    vm.remSet.capacity = 0;
+    vm.gcRequested = false;
+    vm.majorRequested = false;
+    vm.minorRequested = false;
+    initPacer(&vm.pacer);
+    initGCLog(&vm.gcLog);
 
     vm.bytesAllocatedTenure = 0;
-    vm.freeingTenured = false;
 
     vm.grayCount = 0;
     vm.grayCapacity = 0;
     vm.grayStack = NULL;
+    vm.markCount = 0;
+    vm.markCapacity = 0;
+    vm.markStack = NULL;
+    vm.marking = false;
+    vm.markThreads = GC_MARK_THREADS;
+    vm.frameLimit = 0;
+    vm.quiet = false;
+
+    #ifdef CONCURRENT_MARK
+    vm.markerRunning = false;
+    vm.markerDone = false;
+    pthread_mutex_init(&vm.snapshotLock, NULL);
+    vm.snapshotQueue = NULL;
+    vm.snapshotCount = 0;
+    vm.snapshotCapacity = 0;
+    vm.retired = NULL;
+    vm.retiredCount = 0;
+    vm.retiredCapacity = 0;
+    #endif
     vm.bytesAllocated = 0;
 
     initTable(&vm.strings);
-    initTable(&vm.globals);
+    initTable(&vm.globalNames);
+    initValueArray(&vm.globalValues);
+    initValueArray(&vm.globalIdentifiers);
 
     vm.initString = NULL;
     vm.initString = copyString("init", 4);
@@ -109,28 +274,43 @@ void initVM() {
     vm.totalMinorTime = 0;
     vm.totalMajorTime = 0;
 
+    #ifdef DEBUG_INLINE_CACHE
+    vm.cacheHits = 0;
+    vm.cacheMisses = 0;
+    #endif
+
     vm.strX = copyString("x", 1);
     vm.strY = copyString("y", 1);
-    vm.strVector2 = copyString("Vector2", 7);
 
-    vm.strColor = copyString("Color", 5);
     vm.strR = copyString("r", 1);
     vm.strG = copyString("g", 1);
     vm.strB = copyString("b", 1);
     vm.strA = copyString("a", 1);
+
+    vm.gcStatsEntity = NULL;
+    vm.gcStatsEntity = newEntity(copyString("GCStats", 7));
     
-    vm.colorEntity = newEntity(vm.strColor);
 
-    vm.vector2Entity = newEntity(vm.strVector2);
     defineNative("clock", clockNative);
+    defineNative("gcStats", gcStatsNative);
+    defineNative("heapDump", heapDumpNative);
+    #ifdef PROFILE_ALLOCATIONS
+    defineNative("allocationReport", allocationReportNative);
+    #endif
     defineRaylibNatives();
 }
 
 void freeVM(){
     freeTable(&vm.strings);
-    freeTable(&vm.globals);
+    freeTable(&vm.globalNames);
+    freeValueArray(&vm.globalValues);
+    freeValueArray(&vm.globalIdentifiers);
     vm.initString = NULL;
     freeObjects();
+    freeShapes();
+    #ifdef PROFILE_ALLOCATIONS
+    freeAllocationProfile(&vm.profile);
+    #endif
 }
 
 void push (Value value) {
@@ -159,6 +339,15 @@ static bool call(ObjFunction* function, int argCount) {
         return false;
     }
 
+    #ifdef NAN_BOXING
+    //The function could keep an argument past the caller's slot
+    for (Value* arg = vm.stackTop - argCount; arg < vm.stackTop; arg++) {
+        if (IS_VECTOR2(*arg) && isScratchObject(OBJ_VALUE_TO_C(*arg))) {
+            *arg = C_TO_VECTOR2_VALUE(VECTOR2_X(*arg), VECTOR2_Y(*arg));
+        }
+    }
+    #endif
+
     CallFrame* frame = &vm.frames[vm.frameCount++];
     frame->function = function;
     frame->ip = function->chunk.code;
@@ -179,7 +368,18 @@ static bool callValue(Value callee, int argCount) {
                 return call(AS_FUNCTION(callee), argCount);
             case OBJ_NATIVE:{
                 NativeFn native = AS_NATIVE(callee);
+                #ifdef NAN_BOXING
+                ObjVector2* cell = &vm.scratchVectors[vm.stackTop - argCount - 1 - vm.stack];
+                #endif
                 Value result = native(argCount, vm.stackTop - argCount);
+                #ifdef NAN_BOXING
+                //Only the callee's own slot outlives the call
+                vm.scratchTarget = NULL;
+                if (IS_VECTOR2(result) && isScratchObject(OBJ_VALUE_TO_C(result)) &&
+                    AS_VECTOR2(result) != cell) {
+                    result = C_TO_VECTOR2_VALUE(VECTOR2_X(result), VECTOR2_Y(result));
+                }
+                #endif
                 vm.stackTop -= argCount + 1;
                 push(result);
                 return true;
@@ -209,7 +409,7 @@ static bool invoke(ObjString* name, int argCount) {
 
 
   Value value;
-  if (tableGet(&instance->fields, name, &value)) {
+  if (instanceGetField(instance, name, &value)) {
     vm.stackTop[-argCount - 1] = value;
     return callValue(value, argCount);
   }
@@ -238,312 +438,745 @@ static void concatenate(){
     push(C_TO_OBJ_VALUE(result));
 }
 
+static int colorChannelIndex(ObjString* name) {
+    if (name == vm.strR) return 0;
+    if (name == vm.strG) return 1;
+    if (name == vm.strB) return 2;
+    if (name == vm.strA) return 3;
+    return -1;
+}
+
+//Vector2 and Color live inside the Value, so their fields are read straight out of it
+static bool getValueField(Value receiver, ObjString* name, Value* value) {
+    if (IS_VECTOR2(receiver)) {
+        if (name == vm.strX) {
+            *value = C_TO_NUMBER_VALUE(VECTOR2_X(receiver));
+            return true;
+        }
+        if (name == vm.strY) {
+            *value = C_TO_NUMBER_VALUE(VECTOR2_Y(receiver));
+            return true;
+        }
+        return false;
+    }
+
+    if (IS_COLOR(receiver)) {
+        int channel = colorChannelIndex(name);
+        if (channel == -1) return false;
+
+        *value = C_TO_NUMBER_VALUE(COLOR_CHANNEL(COLOR_VALUE_TO_C(receiver), channel));
+        return true;
+    }
+    return false;
+}
+
+//Setting a field builds a new Vector2/Color and stores it back into the variable
+static bool setValueField(Value* receiver, ObjString* name, Value value) {
+    if (IS_VECTOR2(*receiver)) {
+        if (!IS_NUMBER(value)) {
+            runtimeError("Vector2 fields must be numbers.");
+            return false;
+        }
+
+        float number = (float)NUMBER_VALUE_TO_C(value);
+        if (name == vm.strX) {
+            *receiver = C_TO_VECTOR2_VALUE(number, VECTOR2_Y(*receiver));
+            return true;
+        }
+        if (name == vm.strY) {
+            *receiver = C_TO_VECTOR2_VALUE(VECTOR2_X(*receiver), number);
+            return true;
+        }
+        runtimeError("Undefined property '%s'.", name->chars);
+        return false;
+    }
+
+    if (IS_COLOR(*receiver)) {
+        int channel = colorChannelIndex(name);
+        if (channel == -1) {
+            runtimeError("Undefined property '%s'.", name->chars);
+            return false;
+        }
+        if (!IS_NUMBER(value)) {
+            runtimeError("Color fields must be numbers.");
+            return false;
+        }
+
+        uint32_t rgba = COLOR_VALUE_TO_C(*receiver);
+        rgba &= ~((uint32_t)0xff << (channel * 8));
+        rgba |= (uint32_t)valueToChannel(value) << (channel * 8);
+        *receiver = C_TO_COLOR_VALUE(rgba);
+        return true;
+    }
+
+    runtimeError("Only instances have fields.");
+    return false;
+}
+
+#ifdef DEBUG_INLINE_CACHE
+#define CACHE_HIT() (vm.cacheHits++)
+#define CACHE_MISS() (vm.cacheMisses++)
+#else
+#define CACHE_HIT() ((void)0)
+#define CACHE_MISS() ((void)0)
+#endif
+
+static inline int cachedFieldIndex(InlineCache* cache, Shape* shape, Shape** transition) {
+    for (int i = 0; i < cache->count; i++) {
+        if (cache->shapes[i] == shape) {
+            *transition = cache->transitions[i];
+            return cache->indices[i];
+        }
+    }
+    return -1;
+}
+
+static void updateCache(InlineCache* cache, Shape* shape, int index, Shape* transition) {
+    int entry;
+    if (cache->count < INLINE_CACHE_WAYS) {
+        entry = cache->count++;
+    } else {
+        //Megamorphic site, just cycle through the entries
+        entry = cache->next;
+        cache->next = (cache->next + 1) % INLINE_CACHE_WAYS;
+    }
+    cache->shapes[entry] = shape;
+    cache->transitions[entry] = transition;
+    cache->indices[entry] = index;
+}
+
 static InterpretResult run() {
     CallFrame* frame = &vm.frames[vm.frameCount - 1];
 
-    #define READ_BYTE() (*frame->ip++)
+    //The instruction pointer and stack top live in locals so the compiler can
+    //keep them in registers. They are written back to the frame/VM before
+    //anything that can look at them (allocation, calls, runtime errors)
+    register uint8_t* ip = frame->ip;
+    register Value* stackTop = vm.stackTop;
+
+    #define READ_BYTE() (*ip++)
 
     #define READ_SHORT() \
-        (frame->ip += 2, \
-        (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+        (ip += 2, \
+        (uint16_t)((ip[-2] << 8) | ip[-1]))
     
     #define READ_CONSTANT() \
         (frame->function->chunk.constants.values[READ_BYTE()])
 
     #define READ_STRING() AS_STRING(READ_CONSTANT())
 
+    #define READ_CACHE() (&frame->function->chunk.caches[READ_SHORT()])
+
+    #define GLOBAL_NAME(slot) AS_STRING(vm.globalIdentifiers.values[slot])
+
+    #define PUSH(value) (*stackTop++ = (value))
+    #define POP() (*--stackTop)
+    #define PEEK(distance) (stackTop[-1 - (distance)])
+
+    #define STORE_FRAME() \
+        (frame->ip = ip, vm.stackTop = stackTop)
+
+    #define LOAD_FRAME() \
+        (frame = &vm.frames[vm.frameCount - 1], \
+        ip = frame->ip, \
+        stackTop = vm.stackTop)
+
+    //Allocation only asks for a collection, it runs here where every live
+    //value is on the VM stack. Backward jumps and calls bound how long a
+    //request can wait
+    #define SAFEPOINT() \
+        do { \
+            if (vm.gcRequested) { \
+                STORE_FRAME(); \
+                collectRequested(); \
+            } \
+        } while (false)
+
+    #define RUNTIME_ERROR(...) \
+        do { \
+            STORE_FRAME(); \
+            runtimeError(__VA_ARGS__); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } while (false)
+
     #define BINARY_OP(valueType, op)\
         do { \
-            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {\
-                runtimeError("Operands must be numbers."); \
-                return INTERPRET_RUNTIME_ERROR; \
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) {\
+                RUNTIME_ERROR("Operands must be numbers."); \
             }\
-            double b = NUMBER_VALUE_TO_C(pop()); \
-            double a = NUMBER_VALUE_TO_C(pop()); \
-            push(valueType(a op b)); \
+            double b = NUMBER_VALUE_TO_C(POP()); \
+            double a = NUMBER_VALUE_TO_C(POP()); \
+            PUSH(valueType(a op b)); \
         } while (false)
 
-    for(;;){
-        #ifdef DEBUG_TRACE_EXECUTION
-            //Get offset of the instruciton from base of code
-            printf("        ");
-            for (Value* slot = vm.stack; slot < vm.stackTop; slot++){
-                printf("[ ");
-                printValue(*slot);
-                printf(" ]");
-            }
-            printf("\n"); 
-
-            disassembleInstruction(&frame->function->chunk, (int)(frame->ip - frame->function->chunk.code));
-        #endif
-
-        uint8_t instruction;
-        switch(instruction = READ_BYTE()) {
-            case OP_CONSTANT: {
-                Value constant = READ_CONSTANT();
-                push(constant);
-                break;
+    //Rewrites the instruction that was just read, the next time this 
+    //bytecode runs it goes straight to the number-only handler
+    #define QUICKEN(opcode) (ip[-1] = (opcode))
+
+    //A quickened instruction that sees anything other than two numbers 
+    //turns back into the generic one and runs again from the top
+    #define NUMBER_OP(valueType, op, generic) \
+        do { \
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+                QUICKEN(generic); \
+                ip--; \
+                DISPATCH(); \
+            } \
+            double b = NUMBER_VALUE_TO_C(POP()); \
+            PEEK(0) = valueType(NUMBER_VALUE_TO_C(PEEK(0)) op b); \
+        } while (false)
+
+    #ifdef DEBUG_TRACE_EXECUTION
+        #define TRACE_INSTRUCTION() \
+            do { \
+                printf("        "); \
+                for (Value* slot = vm.stack; slot < stackTop; slot++){ \
+                    printf("[ "); \
+                    printValue(*slot); \
+                    printf(" ]"); \
+                } \
+                printf("\n"); \
+                disassembleInstruction(&frame->function->chunk, \
+                                    (int)(ip - frame->function->chunk.code)); \
+            } while (false)
+    #else
+        #define TRACE_INSTRUCTION() do { } while (false)
+    #endif
+
+    #ifdef THREADED_DISPATCH
+        //One indirect jump at the end of every handler instead of a single
+        //shared one at the top of the loop, so each has its own prediction
+        static void* dispatchTable[] = {
+            [OP_RETURN] = &&CODE_OP_RETURN,
+            [OP_ENTITY] = &&CODE_OP_ENTITY,
+            [OP_NEGATE] = &&CODE_OP_NEGATE,
+            [OP_PRINT] = &&CODE_OP_PRINT,
+            [OP_JUMP] = &&CODE_OP_JUMP,
+            [OP_JUMP_IF_FALSE] = &&CODE_OP_JUMP_IF_FALSE,
+            [OP_LOOP] = &&CODE_OP_LOOP,
+            [OP_CALL] = &&CODE_OP_CALL,
+            [OP_CALL_SCRATCH] = &&CODE_OP_CALL_SCRATCH,
+            [OP_POST_INCREMENT] = &&CODE_OP_POST_INCREMENT,
+            [OP_POST_DECREMENT] = &&CODE_OP_POST_DECREMENT,
+            [OP_ADD] = &&CODE_OP_ADD,
+            [OP_SUBTRACT] = &&CODE_OP_SUBTRACT,
+            [OP_MULTIPLY] = &&CODE_OP_MULTIPLY,
+            [OP_DIVIDE] = &&CODE_OP_DIVIDE,
+            [OP_NOT] = &&CODE_OP_NOT,
+            [OP_CONSTANT] = &&CODE_OP_CONSTANT,
+            [OP_NULL] = &&CODE_OP_NULL,
+            [OP_TRUE] = &&CODE_OP_TRUE,
+            [OP_FALSE] = &&CODE_OP_FALSE,
+            [OP_POP] = &&CODE_OP_POP,
+            [OP_GET_LOCAL] = &&CODE_OP_GET_LOCAL,
+            [OP_GET_GLOBAL] = &&CODE_OP_GET_GLOBAL,
+            [OP_DEFINE_GLOBAL] = &&CODE_OP_DEFINE_GLOBAL,
+            [OP_SET_GLOBAL] = &&CODE_OP_SET_GLOBAL,
+            [OP_SET_LOCAL] = &&CODE_OP_SET_LOCAL,
+            [OP_EQUAL] = &&CODE_OP_EQUAL,
+            [OP_GREATER] = &&CODE_OP_GREATER,
+            [OP_LESS] = &&CODE_OP_LESS,
+            [OP_SET_PROPERTY] = &&CODE_OP_SET_PROPERTY,
+            [OP_GET_PROPERTY] = &&CODE_OP_GET_PROPERTY,
+            [OP_SET_LOCAL_PROPERTY] = &&CODE_OP_SET_LOCAL_PROPERTY,
+            [OP_SET_GLOBAL_PROPERTY] = &&CODE_OP_SET_GLOBAL_PROPERTY,
+            [OP_DUP] = &&CODE_OP_DUP,
+            [OP_BUILD_ARRAY] = &&CODE_OP_BUILD_ARRAY,
+            [OP_INDEX_GET] = &&CODE_OP_INDEX_GET,
+            [OP_INDEX_SET] = &&CODE_OP_INDEX_SET,
+            [OP_LOCAL_LESS_CONST_JUMP] = &&CODE_OP_LOCAL_LESS_CONST_JUMP,
+            [OP_INC_LOCAL] = &&CODE_OP_INC_LOCAL,
+            [OP_CALL_GLOBAL] = &&CODE_OP_CALL_GLOBAL,
+            [OP_ADD_NUMBER] = &&CODE_OP_ADD_NUMBER,
+            [OP_SUBTRACT_NUMBER] = &&CODE_OP_SUBTRACT_NUMBER,
+            [OP_GREATER_NUMBER] = &&CODE_OP_GREATER_NUMBER,
+            [OP_LESS_NUMBER] = &&CODE_OP_LESS_NUMBER,
+        };
+
+        #define INTERPRET_LOOP  DISPATCH();
+        #define CASE(opcode)    CODE_##opcode
+        #define DISPATCH() \
+            do { \
+                TRACE_INSTRUCTION(); \
+                goto *dispatchTable[READ_BYTE()]; \
+            } while (false)
+    #else
+        #define INTERPRET_LOOP \
+            loop: \
+                TRACE_INSTRUCTION(); \
+                switch (READ_BYTE())
+        #define CASE(opcode)    case opcode
+        #define DISPATCH()      goto loop
+    #endif
+
+    INTERPRET_LOOP
+    {
+        CASE(OP_CONSTANT): {
+            Value constant = READ_CONSTANT();
+            PUSH(constant);
+            DISPATCH();
+        }
+        CASE(OP_NULL): PUSH(C_TO_NULL_VALUE); DISPATCH();
+        CASE(OP_TRUE): PUSH(C_TO_BOOL_VALUE(true)); DISPATCH();
+        CASE(OP_FALSE): PUSH(C_TO_BOOL_VALUE(false)); DISPATCH();
+        CASE(OP_POP): stackTop--; DISPATCH();
+        CASE(OP_SET_LOCAL): {
+            uint8_t slot = READ_BYTE();
+            frame->slots[slot] = PEEK(0);
+            DISPATCH();
+        }
+        CASE(OP_GET_LOCAL): {
+            uint8_t slot = READ_BYTE();
+            PUSH(frame->slots[slot]);
+            DISPATCH();
+        }
+        CASE(OP_GET_GLOBAL): {
+            uint16_t slot = READ_SHORT();
+            Value value = vm.globalValues.values[slot];
+            if(IS_EMPTY(value)) {
+                RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot)->chars);
             }
-            case OP_NULL: push(C_TO_NULL_VALUE); break;
-            case OP_TRUE: push(C_TO_BOOL_VALUE(true)); break;
-            case OP_FALSE: push(C_TO_BOOL_VALUE(false)); break;
-            case OP_POP: pop(); break;
-            case OP_SET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                frame->slots[slot] = peek(0);
-                break;
+            PUSH(value);
+            DISPATCH();
+        }
+        CASE(OP_DEFINE_GLOBAL): {
+            uint16_t slot = READ_SHORT();
+            //Don't need to make the remSet work here 
+            //Globals are always scanned :D
+            vm.globalValues.values[slot] = POP();
+            DISPATCH();
+        }
+        CASE(OP_SET_GLOBAL): {
+            uint16_t slot = READ_SHORT();
+            Value* global = &vm.globalValues.values[slot];
+            if (IS_EMPTY(*global)) {
+                RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot)->chars);
             }
-            case OP_GET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                push(frame->slots[slot]);
-                break;
+            *global = PEEK(0);
+            DISPATCH();
+        }
+        CASE(OP_SET_LOCAL_PROPERTY): {
+            Value* variable = &frame->slots[READ_BYTE()];
+            if (IS_INSTANCE(*variable)) {
+                //The name and cache operands come next, same as a plain SET_PROPERTY
+                Value value = PEEK(0);
+                PEEK(0) = *variable;
+                PUSH(value);
+                goto setProperty;
             }
-            case OP_GET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                Value value;
-                if(!tableGet(&vm.globals, name, &value)) {
-                    runtimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(value);
-                break;
+
+            ObjString* name = READ_STRING();
+            ip += 2; //Inline cache is only used by instances
+            STORE_FRAME();
+            if (!setValueField(variable, name, PEEK(0))) return INTERPRET_RUNTIME_ERROR;
+            DISPATCH();
+        }
+        CASE(OP_SET_GLOBAL_PROPERTY): {
+            uint16_t slot = READ_SHORT();
+            Value* variable = &vm.globalValues.values[slot];
+            if (IS_EMPTY(*variable)) {
+                RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot)->chars);
             }
-            case OP_DEFINE_GLOBAL: {
-                ObjString* name = READ_STRING();
-                //Don't need to make the remSet work here 
-                //Globals are always scanned :D
-                tableSet(&vm.globals, name, peek(0));
-                pop();
-                break;
+            if (IS_INSTANCE(*variable)) {
+                Value value = PEEK(0);
+                PEEK(0) = *variable;
+                PUSH(value);
+                goto setProperty;
             }
-            case OP_SET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                if (tableSet(&vm.globals, name, peek(0))) {
-                    tableDelete(&vm.globals, name);
-                    runtimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
+
+            ObjString* name = READ_STRING();
+            ip += 2;
+            STORE_FRAME();
+            if (!setValueField(variable, name, PEEK(0))) return INTERPRET_RUNTIME_ERROR;
+            DISPATCH();
+        }
+        CASE(OP_SET_PROPERTY): {
+            if(!IS_INSTANCE(PEEK(1))) {
+                if (IS_VECTOR2(PEEK(1)) || IS_COLOR(PEEK(1))) {
+                    RUNTIME_ERROR("Can only set fields of a Vector2 or Color stored in a variable.");
                 }
-                break;
+                RUNTIME_ERROR("Only instances have fields.");
             }
-            case OP_SET_PROPERTY: {
-                if(!IS_INSTANCE(peek(1))) {
-                    runtimeError("Only instances have fields.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-
-                ObjInstance* instance = AS_INSTANCE(peek(1));
-                tableSet(&instance->fields, READ_STRING(), peek(0));
-
-                Value value = pop();
 
-                writeBarrier((Obj*)instance, value);
-
-                pop();
-                push(value);
-                break;
+        setProperty:;
+            ObjInstance* instance = AS_INSTANCE(PEEK(1));
+            ObjString* name = READ_STRING();
+            InlineCache* cache = READ_CACHE();
+            Shape* shape = instance->shape;
+
+            Shape* transition;
+            int index = cachedFieldIndex(cache, shape, &transition);
+            if (index != -1 && transition == NULL) {
+                CACHE_HIT();
+                snapshotBarrier((Obj*)instance, instance->fields[index]);
+                STORE_SHARED(instance->fields[index], PEEK(0));
+            }
+            else if (index != -1 && index < instance->fieldCapacity) {
+                //Adding a field this site has added before, and there is room for it
+                CACHE_HIT();
+                STORE_SHARED(instance->fields[index], PEEK(0));
+                PUBLISH(instance->shape, transition);
+                if (transition->fieldCount > instance->entity->inlineFields) {
+                    instance->entity->inlineFields = transition->fieldCount;
+                }
             }
-            case OP_GET_PROPERTY: {
-                if(!IS_INSTANCE(peek(0))) {
-                    runtimeError("Only instances have properties.");
-                    return INTERPRET_RUNTIME_ERROR;
+            else {
+                CACHE_MISS();
+                bool isNew = shapeFieldIndex(shape, name) == -1;
+                //Both operands stay on the stack while the fields can grow
+                STORE_FRAME();
+                instanceSetField(instance, name, PEEK(0));
+                //A cached transition that only missed because the fields were
+                //full is already in the cache, adding it again fills the ways
+                if (index == -1) {
+                    updateCache(cache, shape, shapeFieldIndex(instance->shape, name),
+                                isNew ? instance->shape : NULL);
                 }
+            }
+            writeBarrier((Obj*)instance, PEEK(0));
 
-                ObjInstance* instance = AS_INSTANCE(peek(0));
+            Value value = POP();
+            stackTop--;
+            PUSH(value);
+            DISPATCH();
+        }
+        CASE(OP_GET_PROPERTY): {
+            if(!IS_INSTANCE(PEEK(0))) {
                 ObjString* name = READ_STRING();
+                ip += 2;
 
                 Value value;
-                if (tableGet(&instance->fields, name, &value)) {
-                    pop();
-                    push(value);
-                    break;
+                if (getValueField(PEEK(0), name, &value)) {
+                    PEEK(0) = value;
+                    DISPATCH();
                 }
-                runtimeError("Undefined property '%s'.", name->chars);
-                return INTERPRET_RUNTIME_ERROR;
+                if (IS_VECTOR2(PEEK(0)) || IS_COLOR(PEEK(0))) {
+                    RUNTIME_ERROR("Undefined property '%s'.", name->chars);
+                }
+                RUNTIME_ERROR("Only instances have properties.");
             }
-            case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(C_TO_BOOL_VALUE(valuesEqual(a, b)));
-                break;
+
+            ObjInstance* instance = AS_INSTANCE(PEEK(0));
+            ObjString* name = READ_STRING();
+            InlineCache* cache = READ_CACHE();
+
+            Shape* transition;
+            int index = cachedFieldIndex(cache, instance->shape, &transition);
+            if (index != -1) {
+                CACHE_HIT();
+                PEEK(0) = instance->fields[index];
+                DISPATCH();
             }
-            case OP_GREATER:     BINARY_OP(C_TO_BOOL_VALUE, >); break;
-            case OP_LESS:        BINARY_OP(C_TO_BOOL_VALUE, <); break;
-            case OP_POST_INCREMENT: {
-                if (!IS_NUMBER(peek(0))) {
-                    runtimeError("Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
 
-                double value = NUMBER_VALUE_TO_C(pop());
-                push(C_TO_NUMBER_VALUE(value + 1));
-                break;
+            CACHE_MISS();
+            index = shapeFieldIndex(instance->shape, name);
+            if (index != -1) {
+                updateCache(cache, instance->shape, index, NULL);
+                PEEK(0) = instance->fields[index];
+                DISPATCH();
+            }
+            RUNTIME_ERROR("Undefined property '%s'.", name->chars);
+        }
+        CASE(OP_EQUAL): {
+            Value b = POP();
+            Value a = POP();
+            PUSH(C_TO_BOOL_VALUE(valuesEqual(a, b)));
+            DISPATCH();
+        }
+        CASE(OP_GREATER):
+            if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) QUICKEN(OP_GREATER_NUMBER);
+            BINARY_OP(C_TO_BOOL_VALUE, >);
+            DISPATCH();
+        CASE(OP_LESS):
+            if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) QUICKEN(OP_LESS_NUMBER);
+            BINARY_OP(C_TO_BOOL_VALUE, <);
+            DISPATCH();
+        CASE(OP_GREATER_NUMBER): NUMBER_OP(C_TO_BOOL_VALUE, >, OP_GREATER); DISPATCH();
+        CASE(OP_LESS_NUMBER):    NUMBER_OP(C_TO_BOOL_VALUE, <, OP_LESS); DISPATCH();
+        CASE(OP_POST_INCREMENT): {
+            if (!IS_NUMBER(PEEK(0))) {
+                RUNTIME_ERROR("Operand must be a number.");
             }
-            case OP_POST_DECREMENT: {
-                if (!IS_NUMBER(peek(0))) {
-                    runtimeError("Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
 
-                double value = NUMBER_VALUE_TO_C(pop());
-                push(C_TO_NUMBER_VALUE(value - 1));
-                break;
+            double value = NUMBER_VALUE_TO_C(POP());
+            PUSH(C_TO_NUMBER_VALUE(value + 1));
+            DISPATCH();
+        }
+        CASE(OP_POST_DECREMENT): {
+            if (!IS_NUMBER(PEEK(0))) {
+                RUNTIME_ERROR("Operand must be a number.");
             }
-            case OP_ADD:         {
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))){
-                    concatenate(); 
-                }
-                else if(IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))){    
-                    BINARY_OP(C_TO_NUMBER_VALUE, +);
-                }
-                else {
-                    runtimeError(       
-                    "Operands must be two numbers or two strings.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
+
+            double value = NUMBER_VALUE_TO_C(POP());
+            PUSH(C_TO_NUMBER_VALUE(value - 1));
+            DISPATCH();
+        }
+        CASE(OP_ADD):         {
+            if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1))){
+                STORE_FRAME();
+                concatenate(); 
+                stackTop = vm.stackTop;
+            }
+            else if(IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))){    
+                QUICKEN(OP_ADD_NUMBER);
+                BINARY_OP(C_TO_NUMBER_VALUE, +);
+            }
+            else {
+                RUNTIME_ERROR(       
+                "Operands must be two numbers or two strings.");
+            }
+            DISPATCH();
+        }
+        CASE(OP_ADD_NUMBER):  NUMBER_OP(C_TO_NUMBER_VALUE, +, OP_ADD); DISPATCH();
+        CASE(OP_SUBTRACT):
+            if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) QUICKEN(OP_SUBTRACT_NUMBER);
+            BINARY_OP(C_TO_NUMBER_VALUE, -);
+            DISPATCH();
+        CASE(OP_SUBTRACT_NUMBER): NUMBER_OP(C_TO_NUMBER_VALUE, -, OP_SUBTRACT); DISPATCH();
+        CASE(OP_MULTIPLY):    BINARY_OP(C_TO_NUMBER_VALUE, *); DISPATCH();
+        CASE(OP_DIVIDE):      BINARY_OP(C_TO_NUMBER_VALUE, /); DISPATCH();
+        CASE(OP_NOT): PEEK(0) = C_TO_BOOL_VALUE(isFalsey(PEEK(0)));  DISPATCH();
+        CASE(OP_NEGATE):
+            if (!IS_NUMBER(PEEK(0))) {
+                RUNTIME_ERROR("Operand must be a number.");
             }
-            case OP_SUBTRACT:    BINARY_OP(C_TO_NUMBER_VALUE, -); break;
-            case OP_MULTIPLY:    BINARY_OP(C_TO_NUMBER_VALUE, *); break;
-            case OP_DIVIDE:      BINARY_OP(C_TO_NUMBER_VALUE, /); break;
-            case OP_NOT: push(C_TO_BOOL_VALUE(isFalsey(pop())));  break;
-            case OP_NEGATE:
-                if (!IS_NUMBER(peek(0))) {
-                    runtimeError("Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
 
-                push(C_TO_NUMBER_VALUE(-NUMBER_VALUE_TO_C(pop())));
-                break;
-            case OP_PRINT: {
-                printValue(pop());
-                printf("\n");
-                break;
+            PEEK(0) = C_TO_NUMBER_VALUE(-NUMBER_VALUE_TO_C(PEEK(0)));
+            DISPATCH();
+        CASE(OP_PRINT): {
+            printValue(POP());
+            printf("\n");
+            DISPATCH();
+        }
+        CASE(OP_JUMP): {
+            uint16_t offset = READ_SHORT();
+            ip += offset;
+            DISPATCH();
+        }   
+        CASE(OP_JUMP_IF_FALSE): {
+            uint16_t offset = READ_SHORT();
+            if (isFalsey(PEEK(0))) ip += offset;
+            DISPATCH();
+        }
+        CASE(OP_LOOP): {
+            uint16_t offset = READ_SHORT(); 
+            ip -= offset;
+            SAFEPOINT();
+            DISPATCH();
+        }
+        CASE(OP_CALL): {
+            int argCount = READ_BYTE();
+            SAFEPOINT();
+            STORE_FRAME();
+            if(!callValue(PEEK(argCount), argCount)){
+                return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_JUMP: {
-                uint16_t offset = READ_SHORT();
-                frame->ip += offset;
-                break;
-            }   
-            case OP_JUMP_IF_FALSE: {
-                uint16_t offset = READ_SHORT();
-                if (isFalsey(peek(0))) frame->ip += offset;
-                break;
+            LOAD_FRAME();
+            DISPATCH();
+        }
+        CASE(OP_CALL_SCRATCH): {
+            int argCount = READ_BYTE();
+            SAFEPOINT();
+            STORE_FRAME();
+            #ifdef NAN_BOXING
+            //Only a native's Vector2 goes in the slot's cell, a script
+            //function's locals must not pick it up
+            Value* slot = vm.stackTop - argCount - 1;
+            if (IS_NATIVE(*slot)) vm.scratchTarget = &vm.scratchVectors[slot - vm.stack];
+            #endif
+            if(!callValue(PEEK(argCount), argCount)){
+                return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_LOOP: {
-                uint16_t offset = READ_SHORT(); 
-                frame->ip -= offset;
-                break;
+            LOAD_FRAME();
+            DISPATCH();
+        }
+        CASE(OP_LOCAL_LESS_CONST_JUMP): {
+            Value a = frame->slots[READ_BYTE()];
+            Value b = READ_CONSTANT();
+            uint16_t offset = READ_SHORT();
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+                RUNTIME_ERROR("Operands must be numbers.");
             }
-            case OP_CALL: {
-                int argCount = READ_BYTE();
-                if(!callValue(peek(argCount), argCount)){
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+
+            //The condition stays on the stack like OP_JUMP_IF_FALSE leaves it
+            bool isLess = NUMBER_VALUE_TO_C(a) < NUMBER_VALUE_TO_C(b);
+            PUSH(C_TO_BOOL_VALUE(isLess));
+            if (!isLess) ip += offset;
+            DISPATCH();
+        }
+        CASE(OP_INC_LOCAL): {
+            uint8_t slot = READ_BYTE();
+            Value amount = READ_CONSTANT();
+            Value value = frame->slots[slot];
+
+            if (IS_NUMBER(value) && IS_NUMBER(amount)) {
+                frame->slots[slot] = C_TO_NUMBER_VALUE(NUMBER_VALUE_TO_C(value) + 
+                                                    NUMBER_VALUE_TO_C(amount));
             }
-            case OP_ENTITY: {
-                push(C_TO_OBJ_VALUE(newEntity(READ_STRING())));
-                break;
+            else if (IS_STRING(value) && IS_STRING(amount)) {
+                PUSH(value);
+                PUSH(amount);
+                STORE_FRAME();
+                concatenate();
+                stackTop = vm.stackTop;
+                frame->slots[slot] = POP();
             }
-            case OP_DUP: push(peek(0)); break;
-            case OP_BUILD_ARRAY: {
-                uint8_t itemCount = READ_BYTE();
-                Value* items = vm.stackTop - itemCount;
-                
-                ObjArray* array = newArray();
-                push(C_TO_OBJ_VALUE(array)); // Protect from GC during allocation
-                
-                for (int i = 0; i < itemCount; i++) {
-                    arrayWrite(array, items[i]);
-                }
-                
-                pop(); // Remove the protected array
-                vm.stackTop -= itemCount; // Remove the original items
-                push(C_TO_OBJ_VALUE(array)); // Push the final array object
-                break;
+            else {
+                RUNTIME_ERROR("Operands must be two numbers or two strings.");
+            }
+            DISPATCH();
+        }
+        CASE(OP_CALL_GLOBAL): {
+            uint16_t slot = READ_SHORT();
+            Value callee = vm.globalValues.values[slot];
+            if(IS_EMPTY(callee)) {
+                RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot)->chars);
             }
 
-            case OP_INDEX_GET: {
-                Value index = pop();
-                Value arrayVal = pop();
+            PUSH(callee);
+            SAFEPOINT();
+            STORE_FRAME();
+            if(!callValue(PEEK(0), 0)){
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            DISPATCH();
+        }
+        CASE(OP_ENTITY): {
+            ObjString* name = READ_STRING();
+            STORE_FRAME();
+            PUSH(C_TO_OBJ_VALUE(newEntity(name)));
+            DISPATCH();
+        }
+        CASE(OP_DUP): {
+            Value top = PEEK(0);
+            PUSH(top);
+            DISPATCH();
+        }
+        CASE(OP_BUILD_ARRAY): {
+            uint8_t itemCount = READ_BYTE();
+            STORE_FRAME();
+            Value* items = vm.stackTop - itemCount;
+            
+            ObjArray* array = newArray();
+            push(C_TO_OBJ_VALUE(array)); // Protect from GC during allocation
+            
+            for (int i = 0; i < itemCount; i++) {
+                arrayWrite(array, items[i]);
+            }
+            
+            pop(); // Remove the protected array
+            vm.stackTop -= itemCount; // Remove the original items
+            push(C_TO_OBJ_VALUE(array)); // Push the final array object
+            stackTop = vm.stackTop;
+            DISPATCH();
+        }
 
-                if (!IS_ARRAY(arrayVal)) {
-                    runtimeError("Can only index into arrays.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                if (!IS_NUMBER(index)) {
-                    runtimeError("Array index must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+        CASE(OP_INDEX_GET): {
+            Value index = POP();
+            Value arrayVal = POP();
 
-                ObjArray* array = AS_ARRAY(arrayVal);
-                int i = (int)NUMBER_VALUE_TO_C(index);
+            if (!IS_ARRAY(arrayVal)) {
+                RUNTIME_ERROR("Can only index into arrays.");
+            }
+            if (!IS_NUMBER(index)) {
+                RUNTIME_ERROR("Array index must be a number.");
+            }
 
-                if (i < 0 || i >= array->count) {
-                    runtimeError("Index out of bounds.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+            ObjArray* array = AS_ARRAY(arrayVal);
+            int i = (int)NUMBER_VALUE_TO_C(index);
 
-                push(array->elements[i]);
-                break;
+            if (i < 0 || i >= array->count) {
+                RUNTIME_ERROR("Index out of bounds.");
             }
 
-            case OP_INDEX_SET: {
-                Value value = pop();
-                Value index = pop();
-                Value arrayVal = pop();
-
-                if (!IS_ARRAY(arrayVal)) {
-                    runtimeError("Can only index into arrays.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                if (!IS_NUMBER(index)) {
-                    runtimeError("Array index must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+            PUSH(array->elements[i]);
+            DISPATCH();
+        }
 
-                ObjArray* array = AS_ARRAY(arrayVal);
-                int i = (int)NUMBER_VALUE_TO_C(index);
+        CASE(OP_INDEX_SET): {
+            Value value = PEEK(0);
+            Value index = PEEK(1);
+            Value arrayVal = PEEK(2);
 
-                if (i < 0 || i >= array->count) {
-                    runtimeError("Index out of bounds.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+            if (!IS_ARRAY(arrayVal)) {
+                RUNTIME_ERROR("Can only index into arrays.");
+            }
+            if (!IS_NUMBER(index)) {
+                RUNTIME_ERROR("Array index must be a number.");
+            }
 
-                array->elements[i] = value;
-                writeBarrier((Obj*)array, value); // Ensure GC tracks this update
+            ObjArray* array = AS_ARRAY(arrayVal);
+            int i = (int)NUMBER_VALUE_TO_C(index);
 
-                push(value);
-                break;
+            if (i < 0 || i >= array->count) {
+                RUNTIME_ERROR("Index out of bounds.");
             }
-            
-            case OP_RETURN: {
-                Value result = pop();
 
-                // closeUpvalues(frame->slots);
+            snapshotBarrier((Obj*)array, array->elements[i]);
+            STORE_SHARED(array->elements[i], value);
+            //The barrier can grow the remembered set, keep the operands rooted
+            STORE_FRAME();
+            arrayWriteBarrier(array, i, value); // Ensure GC tracks this update
 
-                vm.frameCount--;
-                if (vm.frameCount == 0) {
-                    pop();
-                    return INTERPRET_OK;
-                }
+            stackTop -= 3;
+            PUSH(value);
+            DISPATCH();
+        }
+        
+        CASE(OP_RETURN): {
+            SAFEPOINT();
+            Value result = POP();
+
+            // closeUpvalues(frame->slots);
+
+            vm.frameCount--;
+            if (vm.frameCount == 0) {
+                stackTop--;
+                vm.stackTop = stackTop;
+                return INTERPRET_OK;
+            }
 
-                vm.stackTop = frame->slots;
-                push(result);
+            stackTop = frame->slots;
+            PUSH(result);
+            vm.stackTop = stackTop;
 
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
-            }
+            LOAD_FRAME();
+            DISPATCH();
         }
     }
-    #undef READ_STRING
+
+    //Only reachable through an opcode the table does not know about
+    return INTERPRET_RUNTIME_ERROR;
+
+    #undef INTERPRET_LOOP
+    #undef CASE
+    #undef DISPATCH
+    #undef TRACE_INSTRUCTION
+    #undef NUMBER_OP
+    #undef QUICKEN
+    #undef SAFEPOINT
     #undef BINARY_OP
+    #undef RUNTIME_ERROR
+    #undef LOAD_FRAME
+    #undef STORE_FRAME
+    #undef PEEK
+    #undef POP
+    #undef PUSH
+    #undef GLOBAL_NAME
+    #undef READ_CACHE
+    #undef READ_STRING
     #undef READ_CONSTANT
     #undef READ_SHORT
     #undef READ_BYTE
 }
 
+//Without a window draw() runs for vm.frameLimit frames
+static bool keepDrawing(int frame) {
+    if (vm.frameLimit > 0) return frame < vm.frameLimit;
+    return !WindowShouldClose();
+}
+
 InterpretResult interpret(const char* source) {
     ObjFunction* function = compile(source);
     if (function == NULL) return INTERPRET_COMPILE_ERROR;
@@ -555,19 +1188,39 @@ InterpretResult interpret(const char* source) {
     if(result != INTERPRET_OK) return result;
 
     Value drawValue;
-    if (tableGet(&vm.globals, vm.drawString, &drawValue)) {
-        while(!WindowShouldClose()) {
+    if (getGlobal(vm.drawString, &drawValue)) {
+        for (int frame = 0; keepDrawing(frame); frame++) {
             vm.stackTop = vm.stack;
             push(drawValue);
+            //The previous frame is done, spend some of the gap on the GC
+            pacerBetweenFrames();
+            if (vm.gcRequested) collectRequested();
+            drawValue = vm.stack[0];
+
+            pacerBeginFrame();
+            beginFrameArena();
             if(!callValue(drawValue, 0)) {
                 return INTERPRET_RUNTIME_ERROR;
             }
 
             result = run();
             if(result != INTERPRET_OK) return result;
+            endFrameArena();
+            pacerEndFrame();
         }
     }
+    if (vm.quiet) return INTERPRET_OK;
+
     printf("%f/%f\n", vm.totalMinorTime, vm.totalMajorTime);
+    #ifdef DEBUG_LOG_PACER
+    printPacerStats();
+    #endif
+    #ifdef PROFILE_ALLOCATIONS
+    printAllocationProfile();
+    #endif
+    #ifdef DEBUG_INLINE_CACHE
+    printf("inline cache %zu hits / %zu misses\n", vm.cacheHits, vm.cacheMisses);
+    #endif
 
     return INTERPRET_OK;
 }
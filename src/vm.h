@@ -7,8 +7,15 @@
 #include "value.h"
 #include "object.h"
 #include "natives.h"
+#include "gclog.h"
+#include "pacer.h"
+#include "profile.h"
+#include "slab.h"
 #include "raylib.h"
 #include <time.h>
+#if defined(CONCURRENT_MARK) || defined(PARALLEL_MARK)
+#include <pthread.h>
+#endif
 
 #define FRAMES_MAX 64
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
@@ -19,53 +26,160 @@ typedef struct {
     Value* slots;
 } CallFrame;
 
+#ifdef CONCURRENT_MARK
+typedef struct {
+    void* pointer;
+    size_t size;
+} RetiredBuffer;
+#endif
+
 typedef struct {
     CallFrame frames[FRAMES_MAX];
     int frameCount;
 
     Value stack[STACK_MAX];
     Value* stackTop;
+    #ifdef NAN_BOXING
+    //One Vector2 per stack slot, used by OP_CALL_SCRATCH for a native's
+    //result that never outlives the slot. The GC never moves or frees them
+    ObjVector2 scratchVectors[STACK_MAX];
+    ObjVector2* scratchTarget; //Where the next newVector2 goes, or NULL
+    #endif
     Table strings;
     ObjString* initString;
     ObjString* drawString;
-    Table globals;
-
-    Obj* objects;
-
+    //Globals are resolved to a slot when the code is compiled, the name
+    //table is only used to hand out slots and for error messages
+    Table globalNames;
+    ValueArray globalValues;
+    ValueArray globalIdentifiers;
+
+    Shape* rootShape;
+    Shape* shapes;
+
+    //Size classes the old generation's small objects are allocated from
+    SlabClass slabs[SLAB_CLASS_COUNT];
+    //Every page, for clearing the mark bits
+    SlabPage** slabPages;
+    int slabPageCount;
+    int slabPageCapacity;
+
+    //Young objects are bump allocated here and copied out when they survive
+    uint8_t* nursery;
+    uint8_t* nurseryTop;
+    uint8_t* nurseryEnd;
+    //Young objects that survived a minor collection, swapped every minor
+    uint8_t* survivorFrom;
+    uint8_t* survivorTo;
+    uint8_t* survivorTop;
+    uint8_t* survivorEnd;
+    bool promoteAll;
     size_t bytesAllocated;
-    size_t nextGC;
+
+    #ifdef FRAME_ARENA
+    //draw()'s young objects, bump allocated while frameArenaActive
+    uint8_t* frameArena;
+    uint8_t* frameArenaTop;
+    uint8_t* frameArenaEnd;
+    bool frameArenaActive;
+    bool frameOverflowed; //Spilled into the nursery since the last minor
+    bool frameStrings;    //Interned a string in the arena
+    bool evacuatingFrame;
+    //Objects outside the arena that were given a pointer into it
+    Obj** frameEscapes;
+    int frameEscapeCount;
+    int frameEscapeCapacity;
+    #endif
+
+    //Young objects that own a malloc'd buffer, freed if they die
+    Obj** youngBuffers;
+    int youngBufferCount;
+    int youngBufferCapacity;
+
+    //Set by the allocator, collected at the next safepoint in run()
+    bool gcRequested;
+    bool majorRequested;
+    bool minorRequested;
+    Pacer pacer;
+    GCLog gcLog;
+    ObjEntity* gcStatsEntity; //What gcStats() makes instances of
+    #ifdef PROFILE_ALLOCATIONS
+    AllocationProfile profile;
+    #endif
 
     //GC BENCHMARKING TIME STATS
     double totalMinorTime;
     double totalMajorTime;
+
+    #ifdef DEBUG_INLINE_CACHE
+    size_t cacheHits;
+    size_t cacheMisses;
+    #endif
         
     int grayCount;
     int grayCapacity;
     Obj** grayStack;
 
+    //Old objects still to be scanned by the major mark, which can span
+    //several minors when it is incremental
+    int markCount;
+    int markCapacity;
+    Obj** markStack;
+    bool marking;
+    //Threads a stop-the-world mark is drained on, needs PARALLEL_MARK
+    int markThreads;
+    //Frames draw() is run for without opening a window, 0 runs until the
+    //window is closed
+    int frameLimit;
+    //Compiling and running print nothing of their own, the benchmarks
+    //keep stdout and their timings to themselves
+    bool quiet;
+
+    #ifdef CONCURRENT_MARK
+    pthread_t marker;
+    bool markerRunning;
+    bool markerDone;
+    uint8_t* youngSpaces[3];
+    uint8_t* youngSpaceEnds[3];
+
+    //Old references overwritten while the marker runs
+    pthread_mutex_t snapshotLock;
+    Obj** snapshotQueue;
+    int snapshotCount;
+    int snapshotCapacity;
+
+    //Buffers the marker may still be reading, freed when it is joined
+    RetiredBuffer* retired;
+    int retiredCount;
+    int retiredCapacity;
+    #endif
+
     //OLD objects
     bool isMajor;
     bool isGCing;
-    bool freeingTenured;
     RememberedSet remSet;
-    Obj* tenureObjects;
+    //Set while the last major's slab pages are still being swept, from
+    //vm.slabPages[sweepIndex] up to sweepEnd. Pages added after the major
+    //are past sweepEnd, everything on them is marked
+    bool sweeping;
+    int sweepIndex;
+    int sweepEnd;
+    //Old bytes allocated since the last major started marking. It can't
+    //have judged them, so they are left out of the live size it ends with
+    size_t tenureUnjudged;
 
     size_t bytesAllocatedTenure;
     size_t nextGCTenure;
 
     //VECTOR STUFF
-    ObjString* strVector2;
     ObjString* strX;
     ObjString* strY;
-    ObjEntity* vector2Entity;
 
     // COLOR STUFF
-    ObjString* strColor;
     ObjString* strR;
     ObjString* strG;
     ObjString* strB;
     ObjString* strA;
-    ObjEntity* colorEntity;
     /*
     
     */
@@ -79,10 +193,26 @@ typedef enum {
 
 extern VM vm;
 
+#ifdef FRAME_ARENA
+static inline bool isFrameObject(Obj* object) {
+    return (uint8_t*)object >= vm.frameArena && (uint8_t*)object < vm.frameArenaEnd;
+}
+#endif
+
+#ifdef NAN_BOXING
+static inline bool isScratchObject(Obj* object) {
+    return (ObjVector2*)object >= vm.scratchVectors &&
+           (ObjVector2*)object < vm.scratchVectors + STACK_MAX;
+}
+#endif
+
 void initVM();
 void freeVM();
 InterpretResult interpret(const char* source);
 
+int globalSlot(ObjString* name);
+bool getGlobal(ObjString* name, Value* value);
+
 void push(Value value);
 Value pop();
 